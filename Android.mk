@@ -13,6 +13,9 @@ LOCAL_C_INCLUDES += $(LOCAL_PATH)/include $(XASH3DSRC)/engine
 
 LOCAL_CPPFLAGS += -std=c++0x
 
-LOCAL_SRC_FILES := src/filesystem_impl.cpp src/interface.cpp
+LOCAL_LDLIBS += -lz
+
+LOCAL_SRC_FILES := src/filesystem_impl.cpp src/interface.cpp \
+	src/fs_backend.cpp src/fs_content.cpp src/fs_flush.cpp src/fs_handle.cpp src/fs_index.cpp src/fs_levellog.cpp src/fs_lookup.cpp src/fs_metrics.cpp src/fs_mount.cpp src/fs_pack.cpp src/fs_parse.cpp src/fs_pathid.cpp src/fs_pathtrie.cpp src/fs_prefetch.cpp src/fs_readbuf.cpp src/fs_registry.cpp src/fs_sched.cpp src/fs_stublog.cpp src/fs_trace.cpp src/fs_watch.cpp
 
 include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,593 @@
+/*
+fs_bench.cpp - throughput and latency of filesystem calls against a stand-in engine
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include "filesystem.h"
+
+typedef int qboolean;
+
+#include "fs_int.h"
+
+// Builds a game tree of loose files and a pak in a temporary directory,
+// loads the library over mock_engine.cpp and times each call. Every
+// number is printed as operations per second, and latency of a single
+// call at 50th and 99th percentile. Last, the same calls are made from
+// more and more threads at once
+
+#define BENCH_DIRS		16
+#define BENCH_FILES		64 // per directory
+#define BENCH_PAK_FILES	1024
+#define BENCH_PAK_SIZE	4096 // of each file
+#define BENCH_BIG_LINES	20000 // in text file read by Read and ReadLine
+#define BENCH_OPS		200000 // per benchmark, times the scale given on command line
+
+#define ENGINE_LIBRARY_ENV "FS_STDIO_ENGINE" // same as library's
+
+static IFileSystem *fs;
+static std::string benchRoot;
+static int benchScale = 1;
+static int benchThreads; // most threads to scale to, 0 for every core
+
+static long long NowNsec( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void WriteFile( const std::string &path, const std::string &data )
+{
+	FILE *f = fopen( path.c_str(), "wb" );
+
+	if( !f )
+	{
+		fprintf( stderr, "fs_bench: can't write %s\n", path.c_str() );
+		exit( 1 );
+	}
+
+	fwrite( data.data(), 1, data.size(), f );
+	fclose( f );
+}
+
+// lines like in configs and resource lists, some of them with CRLF
+static std::string TextLines( int count )
+{
+	std::string data;
+	char line[256];
+
+	for( int i = 0; i < count; i++ )
+	{
+		switch( i % 4 )
+		{
+		case 0: snprintf( line, sizeof( line ), "// comment %d\n", i ); break;
+		case 1: snprintf( line, sizeof( line ), "\"key%d\" \"value %d\"\r\n", i, i ); break;
+		case 2: snprintf( line, sizeof( line ), "{ models/model%d.mdl sound/ambience/sound%d.wav }\n", i, i ); break;
+		default: snprintf( line, sizeof( line ), "bind \"%c\" \"+command%d\"\n", 'a' + i % 26, i ); break;
+		}
+
+		data += line;
+	}
+
+	return data;
+}
+
+static void PutLE32( std::string &out, int value )
+{
+	for( int i = 0; i < 4; i++ )
+		out += (char)(( value >> ( i * 8 )) & 0xff );
+}
+
+static void WritePak( const std::string &path )
+{
+	std::string data( 12, 0 ), dir;
+
+	for( int i = 0; i < BENCH_PAK_FILES; i++ )
+	{
+		char name[56];
+		int offset = data.size();
+
+		memset( name, 0, sizeof( name ));
+		snprintf( name, sizeof( name ), "pak%02d/entry%03d.dat", i / 64, i % 64 );
+
+		data.append( BENCH_PAK_SIZE, (char)( 'a' + i % 26 ));
+		dir.append( name, sizeof( name ));
+		PutLE32( dir, offset );
+		PutLE32( dir, BENCH_PAK_SIZE );
+	}
+
+	std::string header = "PACK";
+
+	PutLE32( header, data.size() );
+	PutLE32( header, dir.size() );
+	data.replace( 0, 12, header );
+
+	WriteFile( path, data + dir );
+}
+
+static void MakeTree( void )
+{
+	char temp[] = "/tmp/fs_bench.XXXXXX";
+
+	if( !mkdtemp( temp ))
+	{
+		perror( "fs_bench: mkdtemp" );
+		exit( 1 );
+	}
+
+	benchRoot = temp;
+
+	mkdir(( benchRoot + "/valve" ).c_str(), 0755 );
+	mkdir(( benchRoot + "/mod" ).c_str(), 0755 );
+
+	for( int i = 0; i < BENCH_DIRS; i++ )
+	{
+		char dir[64];
+
+		snprintf( dir, sizeof( dir ), "/valve/data%02d", i );
+		mkdir(( benchRoot + dir ).c_str(), 0755 );
+
+		for( int j = 0; j < BENCH_FILES; j++ )
+		{
+			char name[sizeof( dir ) + 16];
+
+			snprintf( name, sizeof( name ), "%s/file%03d.txt", dir, j );
+			WriteFile( benchRoot + name, TextLines( 16 + j ));
+		}
+	}
+
+	WriteFile( benchRoot + "/valve/big.cfg", TextLines( BENCH_BIG_LINES ));
+	WriteFile( benchRoot + "/mod/big.cfg", TextLines( BENCH_BIG_LINES ));
+	WritePak( benchRoot + "/valve/pak0.pak" );
+}
+
+static int RemoveEntry( const char *path, const struct stat *, int, struct FTW * )
+{
+	return remove( path );
+}
+
+static void RemoveTree( void )
+{
+	if( !benchRoot.empty() )
+		nftw( benchRoot.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS );
+}
+
+static void LoadLibrary( const char *library, const char *engine )
+{
+	// our engine unless told otherwise, library loads it as soon as it's loaded itself
+	setenv( ENGINE_LIBRARY_ENV, engine, 0 );
+
+	void *handle = dlopen( library, RTLD_NOW );
+
+	if( !handle )
+	{
+		fprintf( stderr, "fs_bench: %s\n", dlerror() );
+		exit( 1 );
+	}
+
+	CreateInterfaceFn factory = (CreateInterfaceFn)dlsym( handle, CREATEINTERFACE_PROCNAME );
+
+	if( !factory || !( fs = (IFileSystem *)factory( FILESYSTEM_INTERFACE_VERSION, NULL )))
+	{
+		fprintf( stderr, "fs_bench: %s has no " FILESYSTEM_INTERFACE_VERSION "\n", library );
+		exit( 1 );
+	}
+}
+
+// returns ops per second
+static double Report( const char *name, std::vector<long long> &samples, long long elapsed, long long bytes )
+{
+	if( samples.empty() || elapsed <= 0 )
+		return 0;
+
+	std::sort( samples.begin(), samples.end() );
+
+	size_t count = samples.size();
+	double seconds = elapsed / 1e9;
+	double p50 = samples[count / 2] / 1e3;
+	double p99 = samples[std::min( count - 1, count * 99 / 100 )] / 1e3;
+
+	printf( "%-28s %12.0f ops/s", name, count / seconds );
+
+	if( bytes > 0 )
+		printf( " %9.1f MB/s", bytes / seconds / ( 1024 * 1024 ));
+	else printf( " %14s", "" );
+
+	printf( "   p50 %9.3f us   p99 %9.3f us\n", p50, p99 );
+
+	return count / seconds;
+}
+
+// op( i ) does one call and returns bytes it moved
+template<typename T> static void Run( const char *name, int ops, T op )
+{
+	std::vector<long long> samples( ops );
+	long long bytes = 0;
+
+	// caches warm up, first calls aren't what's measured
+	for( int i = 0; i < ops / 10; i++ )
+		op( i );
+
+	long long start = NowNsec();
+
+	for( int i = 0; i < ops; i++ )
+	{
+		long long begin = NowNsec();
+
+		bytes += op( i );
+		samples[i] = NowNsec() - begin;
+	}
+
+	Report( name, samples, NowNsec() - start, bytes );
+}
+
+static std::string LooseName( int i )
+{
+	char name[64];
+
+	snprintf( name, sizeof( name ), "data%02d/file%03d.txt", ( i / BENCH_FILES ) % BENCH_DIRS, i % BENCH_FILES );
+	return name;
+}
+
+static std::string PakName( int i )
+{
+	char name[64];
+
+	i %= BENCH_PAK_FILES;
+	snprintf( name, sizeof( name ), "pak%02d/entry%03d.dat", i / 64, i % 64 );
+	return name;
+}
+
+static void BenchOpenClose( int ops )
+{
+	std::vector<std::string> loose, pak;
+
+	for( int i = 0; i < BENCH_DIRS * BENCH_FILES; i++ )
+		loose.push_back( LooseName( i ));
+
+	for( int i = 0; i < BENCH_PAK_FILES; i++ )
+		pak.push_back( PakName( i ));
+
+	Run( "Open/Close loose", ops, [&]( int i ) -> long long
+	{
+		FileHandle_t file = fs->Open( loose[i % loose.size()].c_str(), "rb", "GAME" );
+
+		if( file )
+			fs->Close( file );
+		return 0;
+	});
+
+	Run( "Open/Close pak", ops, [&]( int i ) -> long long
+	{
+		FileHandle_t file = fs->Open( pak[i % pak.size()].c_str(), "rb", "GAME" );
+
+		if( file )
+			fs->Close( file );
+		return 0;
+	});
+}
+
+static void BenchRead( int ops )
+{
+	FileHandle_t file = fs->Open( "big.cfg", "rb", "GAME" );
+	char buf[4096];
+
+	if( !file )
+		return;
+
+	Run( "Read 4k", ops, [&]( int ) -> long long
+	{
+		int read = fs->Read( buf, sizeof( buf ), file );
+
+		if( read < (int)sizeof( buf ))
+			fs->Seek( file, 0, FILESYSTEM_SEEK_HEAD );
+		return read;
+	});
+
+	fs->Close( file );
+}
+
+static void BenchReadLine( int ops )
+{
+	FileHandle_t file = fs->Open( "big.cfg", "rb", "GAME" );
+	char line[256];
+
+	if( !file )
+		return;
+
+	Run( "ReadLine", ops, [&]( int ) -> long long
+	{
+		if( !fs->ReadLine( line, sizeof( line ), file ))
+		{
+			fs->Seek( file, 0, FILESYSTEM_SEEK_HEAD );
+			return 0;
+		}
+
+		return strlen( line );
+	});
+
+	fs->Close( file );
+
+	// what ReadLine used to be: engine's FS_Getc for every byte
+	void *library = dlopen( getenv( ENGINE_LIBRARY_ENV ), RTLD_NOW );
+	pfnFS_GetAPI getAPI = library ? (pfnFS_GetAPI)dlsym( library, FS_API_EXPORT ) : NULL;
+	fs_api_t api;
+
+	if( !getAPI || !getAPI( &api ))
+		return;
+
+	file_t *native = api.FS_Open( "big.cfg", "rb", false );
+
+	if( !native )
+		return;
+
+	Run( "ReadLine per byte", ops, [&]( int ) -> long long
+	{
+		if( api.FS_Eof( native ))
+		{
+			api.FS_Seek( native, 0, SEEK_SET );
+			return 0;
+		}
+
+		char *p = line;
+
+		for( int i = 0; i < (int)sizeof( line ) - 1; i++ )
+		{
+			*p = api.FS_Getc( native );
+
+			if( *p == '\n' || *p == -1 )
+				break;
+
+			p++;
+		}
+
+		if( p != line && *( p - 1 ) == '\r' )
+			*( p - 1 ) = 0;
+		else *p = 0;
+
+		return strlen( line );
+	});
+
+	api.FS_Close( native );
+}
+
+static void BenchLookups( int ops )
+{
+	std::vector<std::string> names, missing;
+
+	for( int i = 0; i < BENCH_DIRS * BENCH_FILES; i++ )
+	{
+		char name[64];
+
+		names.push_back( i % 2 ? LooseName( i ) : PakName( i ));
+		snprintf( name, sizeof( name ), "missing%02d/file%03d.txt", i / BENCH_FILES, i % BENCH_FILES );
+		missing.push_back( name );
+	}
+
+	Run( "Size", ops, [&]( int i ) -> long long
+	{
+		fs->Size( names[i % names.size()].c_str() );
+		return 0;
+	});
+
+	Run( "FileExists hit", ops, [&]( int i ) -> long long
+	{
+		fs->FileExists( names[i % names.size()].c_str() );
+		return 0;
+	});
+
+	Run( "FileExists miss", ops, [&]( int i ) -> long long
+	{
+		fs->FileExists( missing[i % missing.size()].c_str() );
+		return 0;
+	});
+}
+
+// whole directory listed with one FindFirst and FindNext for the rest
+static void BenchFind( int ops )
+{
+	Run( "FindFirst/FindNext", ops, [&]( int i ) -> long long
+	{
+		FileFindHandle_t handle;
+		char pattern[64];
+
+		snprintf( pattern, sizeof( pattern ), "data%02d/*.txt", i % BENCH_DIRS );
+
+		for( const char *name = fs->FindFirst( pattern, &handle, "GAME" ); name; name = fs->FindNext( handle ));
+
+		fs->FindClose( handle );
+		return 0;
+	});
+}
+
+static void BenchRelativePath( int ops )
+{
+	std::vector<std::string> paths;
+	char relative[PATH_MAX];
+
+	for( int i = 0; i < BENCH_DIRS * BENCH_FILES; i++ )
+		paths.push_back( benchRoot + "/valve/" + LooseName( i ));
+
+	Run( "FullPathToRelativePath", ops, [&]( int i ) -> long long
+	{
+		fs->FullPathToRelativePath( paths[i % paths.size()].c_str(), relative );
+		return 0;
+	});
+}
+
+// whole big.cfg tokenized per call, it's in memory so only ParseFile is timed
+static void BenchParseFile( int ops )
+{
+	FileHandle_t file = fs->Open( "big.cfg", "rb", "GAME" );
+
+	if( !file )
+		return;
+
+	std::vector<char> data( fs->Size( file ) + 1 );
+
+	data.resize( fs->Read( &data[0], (int)data.size() - 1, file ) + 1 );
+	data.back() = 0;
+	fs->Close( file );
+
+	char token[1024]; // com_token size
+	bool quoted;
+	long long tokens = 0;
+
+	Run( "ParseFile big.cfg", ops, [&]( int ) -> long long
+	{
+		for( char *p = &data[0]; ( p = fs->ParseFile( p, token, &quoted )); tokens++ );
+		return (long long)data.size() - 1;
+	});
+
+	printf( "%-28s %12.0f tokens per file\n", "", (double)tokens / ( ops + ops / 10 ));
+}
+
+// Open, Read and Close of different files on every thread, same work split
+// between more and more of them. Only search path changes serialize,
+// so this should scale with cores
+static void BenchThreads( int ops )
+{
+	int maxThreads = benchThreads ? benchThreads : std::thread::hardware_concurrency();
+	double single = 0;
+
+	if( maxThreads < 2 )
+		maxThreads = 2;
+
+	for( int threads = 1; threads <= maxThreads; threads = ( threads * 2 > maxThreads && threads < maxThreads ) ? maxThreads : threads * 2 )
+	{
+		std::vector<std::vector<long long> > samples( threads );
+		std::vector<long long> bytes( threads );
+		std::vector<std::thread> workers;
+		std::atomic<int> ready( 0 );
+		std::atomic<bool> go( false );
+		int perThread = ops / threads;
+
+		for( int t = 0; t < threads; t++ )
+		{
+			workers.push_back( std::thread( [&, t]()
+			{
+				char buf[4096];
+
+				samples[t].resize( perThread );
+				bytes[t] = 0;
+				ready++;
+
+				while( !go.load() )
+					std::this_thread::yield();
+
+				for( int i = 0; i < perThread; i++ )
+				{
+					int n = i * threads + t;
+					std::string name = n % 2 ? LooseName( n ) : PakName( n );
+					long long begin = NowNsec();
+					FileHandle_t file = fs->Open( name.c_str(), "rb", "GAME" );
+
+					if( file )
+					{
+						bytes[t] += fs->Read( buf, sizeof( buf ), file );
+						fs->Close( file );
+					}
+
+					samples[t][i] = NowNsec() - begin;
+				}
+			}));
+		}
+
+		while( ready.load() < threads )
+			std::this_thread::yield();
+
+		long long start = NowNsec();
+
+		go = true;
+
+		for( int t = 0; t < threads; t++ )
+			workers[t].join();
+
+		long long elapsed = NowNsec() - start;
+		std::vector<long long> all;
+		long long total = 0;
+		char name[64];
+
+		for( int t = 0; t < threads; t++ )
+		{
+			all.insert( all.end(), samples[t].begin(), samples[t].end() );
+			total += bytes[t];
+		}
+
+		snprintf( name, sizeof( name ), "Open/Read/Close %d threads", threads );
+
+		double rate = Report( name, all, elapsed, total );
+
+		if( threads == 1 )
+			single = rate;
+		else if( single > 0 )
+			printf( "%-28s %11.2fx of one thread\n", "", rate / single );
+	}
+}
+
+int main( int argc, char **argv )
+{
+	if( argc > 1 )
+		benchScale = atoi( argv[1] ) > 0 ? atoi( argv[1] ) : 1;
+
+	if( argc > 2 )
+		benchThreads = atoi( argv[2] ) > 0 ? atoi( argv[2] ) : 0;
+
+	int ops = BENCH_OPS * benchScale;
+
+	MakeTree();
+
+	// search paths are relative, like engine's
+	if( chdir( benchRoot.c_str() ))
+	{
+		perror( "fs_bench: chdir" );
+		RemoveTree();
+		return 1;
+	}
+
+	LoadLibrary( BENCH_LIBRARY, BENCH_ENGINE );
+
+	fs->AddSearchPath( "valve", "GAME" );
+	fs->AddSearchPath( "mod", "GAME" );
+	fs->Mount();
+
+	printf( "fs_bench: %d loose files, %d in pak, %d ops each\n", BENCH_DIRS * BENCH_FILES, BENCH_PAK_FILES, ops );
+
+	BenchOpenClose( ops );
+	BenchRead( ops );
+	BenchReadLine( ops );
+	BenchLookups( ops );
+	BenchFind( ops / 20 );
+	BenchRelativePath( ops );
+	BenchParseFile( ops / 1000 );
+	BenchThreads( ops );
+
+	fs->Unmount();
+	RemoveTree();
+
+	return 0;
+}
@@ -0,0 +1,583 @@
+/*
+mock_engine.cpp - stand-in for engine's filesystem, so library can be measured alone
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <unordered_map>
+
+typedef int qboolean;
+
+#include "fs_int.h"
+
+// Serves loose directories and id paks from disk the way engine does,
+// nothing more. Library serializes it's calls to engine, so there are
+// no locks here either
+
+struct packFile_t
+{
+	std::string name;
+	fs_offset_t offset;
+	fs_offset_t size;
+};
+
+struct pack_s
+{
+	char filename[MAX_SYSPATH];
+	int handle;
+	std::vector<packFile_t> files;
+	std::unordered_map<std::string, int> lookup; // lowercased name
+};
+
+struct file_s
+{
+	int handle;
+	fs_offset_t offset; // of data in pack, 0 for loose files
+	fs_offset_t length;
+	fs_offset_t position;
+	bool pack; // handle is shared with the pack
+};
+
+static searchpath_t *searchPaths;
+static char writeDir[MAX_SYSPATH];
+
+static std::string LowerName( const char *name )
+{
+	std::string out = name;
+
+	for( size_t i = 0; i < out.size(); i++ )
+		out[i] = out[i] == '\\' ? '/' : tolower( out[i] );
+
+	return out;
+}
+
+static void Mock_Msg( const char *pMsg, ... )
+{
+	va_list args;
+
+	va_start( args, pMsg );
+	vprintf( pMsg, args );
+	va_end( args );
+}
+
+static void Mock_MemFree( void *data, const char *, int )
+{
+	free( data );
+}
+
+static pack_t *LoadPack( const char *path )
+{
+	int handle = open( path, O_RDONLY );
+	char header[12];
+
+	if( handle < 0 )
+		return NULL;
+
+	if( pread( handle, header, sizeof( header ), 0 ) != sizeof( header ) || memcmp( header, "PACK", 4 ))
+	{
+		close( handle );
+		return NULL;
+	}
+
+	int dirofs, dirlen;
+
+	memcpy( &dirofs, header + 4, 4 );
+	memcpy( &dirlen, header + 8, 4 );
+
+	std::vector<char> dir( dirlen );
+
+	if( dirlen < 0 || pread( handle, dir.data(), dirlen, dirofs ) != dirlen )
+	{
+		close( handle );
+		return NULL;
+	}
+
+	pack_t *pack = new pack_t;
+
+	snprintf( pack->filename, sizeof( pack->filename ), "%s", path );
+	pack->handle = handle;
+
+	for( int i = 0; i < dirlen / 64; i++ )
+	{
+		const char *p = dir.data() + i * 64;
+		packFile_t file;
+		int offset, size;
+
+		file.name = std::string( p, strnlen( p, 56 ));
+		memcpy( &offset, p + 56, 4 );
+		memcpy( &size, p + 60, 4 );
+		file.offset = offset;
+		file.size = size;
+
+		pack->lookup[LowerName( file.name.c_str() )] = pack->files.size();
+		pack->files.push_back( file );
+	}
+
+	return pack;
+}
+
+static void PrependSearchPath( const char *filename, pack_t *pack, int flags )
+{
+	searchpath_t *search = (searchpath_t *)calloc( 1, sizeof( *search ));
+
+	snprintf( search->filename, sizeof( search->filename ), "%s", filename );
+	search->pack = pack;
+	search->flags = flags;
+	search->next = searchPaths;
+	searchPaths = search;
+}
+
+// paks of directory go under it, later ones win
+static void Mock_AddGameDirectory( const char *dir, int flags )
+{
+	std::vector<std::string> paks;
+	DIR *d = opendir( dir );
+
+	if( d )
+	{
+		while( struct dirent *ent = readdir( d ))
+		{
+			const char *ext = strrchr( ent->d_name, '.' );
+
+			if( ext && !strcasecmp( ext, ".pak" ))
+				paks.push_back( std::string( dir ) + "/" + ent->d_name );
+		}
+
+		closedir( d );
+	}
+
+	std::sort( paks.begin(), paks.end() );
+
+	for( size_t i = 0; i < paks.size(); i++ )
+	{
+		pack_t *pack = LoadPack( paks[i].c_str() );
+
+		if( pack )
+			PrependSearchPath( paks[i].c_str(), pack, flags | FS_GAMEDIR_PATH );
+	}
+
+	std::string path = dir;
+
+	if( path.empty() || path[path.size() - 1] != '/' )
+		path += '/';
+
+	PrependSearchPath( path.c_str(), NULL, flags | FS_GAMEDIR_PATH );
+
+	if( !( flags & FS_NOWRITE_PATH ))
+		snprintf( writeDir, sizeof( writeDir ), "%s", path.c_str() );
+}
+
+static searchpath_t *Mock_FindFile( const char *name, int *index, qboolean gamedironly )
+{
+	std::string lower = LowerName( name );
+
+	for( searchpath_t *search = searchPaths; search; search = search->next )
+	{
+		if( gamedironly && !( search->flags & FS_GAMEDIRONLY_SEARCH_FLAGS ))
+			continue;
+
+		if( search->pack )
+		{
+			std::unordered_map<std::string, int>::const_iterator it = search->pack->lookup.find( lower );
+
+			if( it == search->pack->lookup.end() )
+				continue;
+
+			if( index ) *index = it->second;
+			return search;
+		}
+
+		std::string path = std::string( search->filename ) + name;
+		struct stat st;
+
+		if( stat( path.c_str(), &st ) == 0 && S_ISREG( st.st_mode ))
+		{
+			if( index ) *index = -1;
+			return search;
+		}
+	}
+
+	return NULL;
+}
+
+// like engine's, path is taken as it is, not from write dir
+static void Mock_CreatePath( char *path )
+{
+	for( char *p = strchr( path, '/' ); p; p = strchr( p + 1, '/' ))
+	{
+		*p = 0;
+		mkdir( path, 0755 );
+		*p = '/';
+	}
+}
+
+static file_t *Mock_Open( const char *filepath, const char *mode, qboolean gamedironly )
+{
+	file_t *file;
+
+	if( strpbrk( mode, "wa+" ))
+	{
+		std::string path = std::string( writeDir ) + filepath;
+		int flags = strchr( mode, '+' ) ? O_RDWR : O_WRONLY;
+
+		if( mode[0] == 'w' )
+			flags |= O_CREAT | O_TRUNC;
+		else if( mode[0] == 'a' )
+			flags |= O_CREAT | O_APPEND;
+
+		// engine creates directories up to the file
+		Mock_CreatePath( &path[0] );
+
+		int handle = open( path.c_str(), flags, 0666 );
+
+		if( handle < 0 )
+			return NULL;
+
+		file = new file_t;
+		file->handle = handle;
+		file->offset = 0;
+		file->length = lseek( handle, 0, SEEK_END );
+		file->position = mode[0] == 'a' ? file->length : 0;
+		file->pack = false;
+		return file;
+	}
+
+	int index;
+	searchpath_t *search = Mock_FindFile( filepath, &index, gamedironly );
+
+	if( !search )
+		return NULL;
+
+	file = new file_t;
+	file->position = 0;
+
+	if( search->pack )
+	{
+		const packFile_t &entry = search->pack->files[index];
+
+		file->handle = search->pack->handle;
+		file->offset = entry.offset;
+		file->length = entry.size;
+		file->pack = true;
+		return file;
+	}
+
+	std::string path = std::string( search->filename ) + filepath;
+
+	file->handle = open( path.c_str(), O_RDONLY );
+	file->offset = 0;
+	file->length = file->handle < 0 ? 0 : lseek( file->handle, 0, SEEK_END );
+	file->pack = false;
+
+	if( file->handle < 0 )
+	{
+		delete file;
+		return NULL;
+	}
+
+	return file;
+}
+
+static fs_offset_t Mock_Write( file_t *file, const void *data, size_t datasize )
+{
+	ssize_t done = pwrite( file->handle, data, datasize, file->offset + file->position );
+
+	if( done < 0 )
+		return -1;
+
+	file->position += done;
+
+	if( file->position > file->length )
+		file->length = file->position;
+
+	return done;
+}
+
+static fs_offset_t Mock_Read( file_t *file, void *buffer, size_t buffersize )
+{
+	fs_offset_t left = file->length - file->position;
+
+	if( left <= 0 )
+		return 0;
+
+	if( (fs_offset_t)buffersize > left )
+		buffersize = left;
+
+	ssize_t done = pread( file->handle, buffer, buffersize, file->offset + file->position );
+
+	if( done < 0 )
+		return -1;
+
+	file->position += done;
+	return done;
+}
+
+static int Mock_Seek( file_t *file, fs_offset_t offset, int whence )
+{
+	fs_offset_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? file->position : file->length;
+
+	if( base + offset < 0 || base + offset > file->length )
+		return -1;
+
+	file->position = base + offset;
+	return 0;
+}
+
+static fs_offset_t Mock_Tell( file_t *file )
+{
+	return file->position;
+}
+
+static qboolean Mock_Eof( file_t *file )
+{
+	return file->position >= file->length;
+}
+
+static int Mock_Flush( file_t * )
+{
+	return 0;
+}
+
+static int Mock_Close( file_t *file )
+{
+	if( !file->pack )
+		close( file->handle );
+
+	delete file;
+	return 0;
+}
+
+static int Mock_Getc( file_t *file )
+{
+	unsigned char c;
+
+	if( Mock_Read( file, &c, 1 ) != 1 )
+		return EOF;
+
+	return c;
+}
+
+static int Mock_VPrintf( file_t *file, const char *format, va_list ap )
+{
+	char buf[8192];
+	int len = vsnprintf( buf, sizeof( buf ), format, ap );
+
+	if( len < 0 )
+		return -1;
+
+	if( len >= (int)sizeof( buf ))
+		len = sizeof( buf ) - 1;
+
+	return Mock_Write( file, buf, len );
+}
+
+static byte *Mock_LoadFile( const char *path, fs_offset_t *filesizeptr, qboolean gamedironly )
+{
+	file_t *file = Mock_Open( path, "rb", gamedironly );
+
+	if( !file )
+		return NULL;
+
+	byte *data = (byte *)malloc( file->length + 1 );
+
+	if( data && Mock_Read( file, data, file->length ) == file->length )
+	{
+		data[file->length] = 0;
+
+		if( filesizeptr )
+			*filesizeptr = file->length;
+	}
+	else
+	{
+		free( data );
+		data = NULL;
+	}
+
+	Mock_Close( file );
+	return data;
+}
+
+static int Mock_FileExists( const char *filename, int gamedironly )
+{
+	return Mock_FindFile( filename, NULL, gamedironly ) != NULL;
+}
+
+static int Mock_FileTime( const char *filename, qboolean gamedironly )
+{
+	searchpath_t *search = Mock_FindFile( filename, NULL, gamedironly );
+	struct stat st;
+
+	if( !search )
+		return -1;
+
+	if( search->pack )
+		return fstat( search->pack->handle, &st ) == 0 ? st.st_mtime : -1;
+
+	return stat(( std::string( search->filename ) + filename ).c_str(), &st ) == 0 ? st.st_mtime : -1;
+}
+
+static fs_offset_t Mock_FileSize( const char *filename, qboolean gamedironly )
+{
+	file_t *file = Mock_Open( filename, "rb", gamedironly );
+
+	if( !file )
+		return -1;
+
+	fs_offset_t length = file->length;
+
+	Mock_Close( file );
+	return length;
+}
+
+static const char *Mock_GetDiskPath( const char *name, qboolean gamedironly )
+{
+	static char path[MAX_SYSPATH];
+	searchpath_t *search = Mock_FindFile( name, NULL, gamedironly );
+
+	if( !search || search->pack )
+		return NULL;
+
+	snprintf( path, sizeof( path ), "%s%s", search->filename, name );
+	return path;
+}
+
+// names in pattern's directory of every search path, each one once
+static search_t *Mock_Search( const char *pattern, int caseinsensitive, int gamedironly )
+{
+	std::set<std::string> found;
+	const char *slash = strrchr( pattern, '/' );
+	std::string dir = slash ? std::string( pattern, slash - pattern + 1 ) : std::string();
+	int flags = FNM_PATHNAME | ( caseinsensitive ? FNM_CASEFOLD : 0 );
+
+	for( searchpath_t *search = searchPaths; search; search = search->next )
+	{
+		if( gamedironly && !( search->flags & FS_GAMEDIRONLY_SEARCH_FLAGS ))
+			continue;
+
+		if( search->pack )
+		{
+			for( size_t i = 0; i < search->pack->files.size(); i++ )
+			{
+				std::string name = search->pack->files[i].name;
+
+				// directories of pack are matched too
+				while( !name.empty() )
+				{
+					if( !fnmatch( pattern, name.c_str(), flags ))
+						found.insert( name );
+
+					size_t last = name.rfind( '/' );
+
+					if( last == std::string::npos )
+						break;
+
+					name.erase( last );
+				}
+			}
+
+			continue;
+		}
+
+		DIR *d = opendir(( std::string( search->filename ) + dir ).c_str() );
+
+		if( !d )
+			continue;
+
+		while( struct dirent *ent = readdir( d ))
+		{
+			std::string name = dir + ent->d_name;
+
+			if( ent->d_name[0] != '.' && !fnmatch( pattern, name.c_str(), flags ))
+				found.insert( name );
+		}
+
+		closedir( d );
+	}
+
+	if( found.empty() )
+		return NULL;
+
+	// one block, freed with a single Mem_Free like engine's
+	size_t size = sizeof( search_t ) + ( found.size() + 1 ) * sizeof( char * );
+	std::set<std::string>::const_iterator it;
+
+	for( it = found.begin(); it != found.end(); ++it )
+		size += it->size() + 1;
+
+	search_t *result = (search_t *)malloc( size );
+	char *names = (char *)result + sizeof( search_t ) + ( found.size() + 1 ) * sizeof( char * );
+	int i = 0;
+
+	result->numfilenames = found.size();
+	result->filenames = (char **)( result + 1 );
+	result->filenamesbuffer = NULL;
+
+	for( it = found.begin(); it != found.end(); ++it )
+	{
+		memcpy( names, it->c_str(), it->size() + 1 );
+		result->filenames[i++] = names;
+		names += it->size() + 1;
+	}
+
+	result->filenames[i] = NULL;
+	return result;
+}
+
+static searchpath_t *Mock_GetSearchPaths( void )
+{
+	return searchPaths;
+}
+
+extern "C" int FS_GetAPI( fs_api_t *api )
+{
+	memset( api, 0, sizeof( *api ));
+
+	api->version = FS_API_VERSION;
+	api->Msg = Mock_Msg;
+	api->_Mem_Free = Mock_MemFree;
+	api->FS_AddGameDirectory = Mock_AddGameDirectory;
+	api->FS_Search = Mock_Search;
+	api->FS_Open = Mock_Open;
+	api->FS_Write = Mock_Write;
+	api->FS_Read = Mock_Read;
+	api->FS_Seek = Mock_Seek;
+	api->FS_Tell = Mock_Tell;
+	api->FS_Eof = Mock_Eof;
+	api->FS_Flush = Mock_Flush;
+	api->FS_Close = Mock_Close;
+	api->FS_Getc = Mock_Getc;
+	api->FS_VPrintf = Mock_VPrintf;
+	api->FS_LoadFile = Mock_LoadFile;
+	api->FS_FileExists = Mock_FileExists;
+	api->FS_FileTime = Mock_FileTime;
+	api->FS_FileSize = Mock_FileSize;
+	api->FS_GetDiskPath = Mock_GetDiskPath;
+	api->FS_CreatePath = Mock_CreatePath;
+	api->FS_FindFile = Mock_FindFile;
+	api->FS_GetSearchPaths = Mock_GetSearchPaths;
+
+	return 1;
+}
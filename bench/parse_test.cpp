@@ -0,0 +1,256 @@
+/*
+parse_test.cpp - ParseFile conformance with GoldSrc COM_Parse
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "fs_parse.h"
+
+// Corpus of inputs with tokens they must give, then ParseToken is
+// compared with COM_Parse itself on random inputs. Where we differ on
+// purpose, inputs are kept out of the comparison:
+// - bytes above 127 are word characters, COM_Parse took them for whitespace
+// - tokens are cut at PARSE_TOKEN_MAX, COM_Parse overflowed com_token
+// - unterminated quoted string stops at the terminator, COM_Parse
+//   returned past it, so that end isn't compared
+
+#define RANDOM_CASES	200000
+#define RANDOM_MAX_LEN	128
+
+struct parseCase_t
+{
+	const char *name;
+	const char *input;
+	std::vector<std::string> tokens; // quoted ones start with "
+};
+
+static const parseCase_t corpus[] =
+{
+	{ "empty", "", { } },
+	{ "whitespace only", " \t\r\n ", { } },
+	{ "single word", "hello", { "hello" } },
+	{ "words", "  one two\tthree\r\nfour ", { "one", "two", "three", "four" } },
+	{ "control characters", "a\x01" "b\x1f" "c", { "a", "b", "c" } },
+	{ "comment only", "// nothing here", { } },
+	{ "comment to end of line", "a // b c\nd", { "a", "d" } },
+	{ "comments in a row", "// one\n// two\n\nx", { "x" } },
+	{ "single slash is a word", "a/b /c", { "a/b", "/c" } },
+	{ "comment right after word", "a//b\nc", { "a//b", "c" } },
+	{ "quoted", "\"hello world\"", { "\"hello world" } },
+	{ "quoted empty", "\"\" x", { "\"", "x" } },
+	{ "quoted with comment", "\"// not a comment\"", { "\"// not a comment" } },
+	{ "quoted across lines", "\"a\nb\" c", { "\"a\nb", "c" } },
+	{ "quoted keeps braces", "\"{ } ( ) ' ,\"", { "\"{ } ( ) ' ," } },
+	{ "quote ends word", "ab\"cd\"", { "ab\"cd\"" } },
+	{ "quote after word", "ab \"cd\"ef", { "ab", "\"cd", "ef" } },
+	{ "unterminated quote", "x \"abc", { "x", "\"abc" } },
+	{ "single characters", "{}()',", { "{", "}", "(", ")", "'", "," } },
+	{ "single characters end words", "a{b}c(d)e'f,g", { "a", "{", "b", "}", "c", "(", "d", ")", "e", "'", "f", ",", "g" } },
+	{ "other punctuation is word", "a;b:c=d[e]", { "a;b:c=d[e]" } },
+	{ "entity block",
+		"{\n\"classname\" \"worldspawn\"\n\"wad\" \"\\valve\\halflife.wad\"\n}\n",
+		{ "{", "\"classname", "\"worldspawn", "\"wad", "\"\\valve\\halflife.wad", "}" } },
+	{ "liblist.gam",
+		"// Valve Game Info file\ngame \"Half-Life\"\nstartmap \"c0a0\"\ngamedll_linux \"dlls/hl.so\"\n",
+		{ "game", "\"Half-Life", "startmap", "\"c0a0", "gamedll_linux", "\"dlls/hl.so" } },
+	{ "resource list",
+		"// .res file\n\"models/player.mdl\"\nsound/ambience/wind1.wav\r\n\"gfx/env/skyup.tga\"\n",
+		{ "\"models/player.mdl", "sound/ambience/wind1.wav", "\"gfx/env/skyup.tga" } },
+	{ "materials.txt",
+		"// texture types\nM METAL1_1\nC CRETE2_4\nG GRATE1\nW {WATER\n",
+		{ "M", "METAL1_1", "C", "CRETE2_4", "G", "GRATE1", "W", "{", "WATER" } },
+	{ "config",
+		"bind \"w\" \"+forward\"\nalias +jd \"+jump;+duck\" // jump duck\nsv_gravity 800\n",
+		{ "bind", "\"w", "\"+forward", "alias", "+jd", "\"+jump;+duck", "sv_gravity", "800" } },
+};
+
+// GoldSrc COM_Parse, com_token made big enough for what random cases give
+static char com_token[RANDOM_MAX_LEN + 2];
+static bool com_quoted;
+
+static char *COM_Parse( char *data )
+{
+	int c;
+	int len = 0;
+
+	com_token[0] = 0;
+	com_quoted = false;
+
+	if( !data )
+		return NULL;
+
+skipwhite:
+	while(( c = *data ) <= ' ' )
+	{
+		if( c == 0 )
+			return NULL;
+		data++;
+	}
+
+	if( c == '/' && data[1] == '/' )
+	{
+		while( *data && *data != '\n' )
+			data++;
+		goto skipwhite;
+	}
+
+	if( c == '\"' )
+	{
+		com_quoted = true;
+		data++;
+
+		while( 1 )
+		{
+			c = *data++;
+
+			if( c == '\"' || !c )
+			{
+				com_token[len] = 0;
+				return data;
+			}
+
+			com_token[len] = c;
+			len++;
+		}
+	}
+
+	if( c == '{' || c == '}' || c == ')' || c == '(' || c == '\'' || c == ',' )
+	{
+		com_token[len] = c;
+		len++;
+		com_token[len] = 0;
+		return data + 1;
+	}
+
+	do
+	{
+		com_token[len] = c;
+		data++;
+		len++;
+		c = *data;
+
+		if( c == '{' || c == '}' || c == ')' || c == '(' || c == '\'' || c == ',' )
+			break;
+	} while( c > 32 );
+
+	com_token[len] = 0;
+	return data;
+}
+
+static std::vector<std::string> Tokenize( const char *input )
+{
+	std::vector<std::string> tokens;
+	std::string copy = input;
+	char token[PARSE_TOKEN_MAX];
+	bool quoted;
+	char *data = &copy[0];
+
+	while(( data = ParseToken( data, token, &quoted )))
+		tokens.push_back( quoted ? std::string( "\"" ) + token : std::string( token ));
+
+	return tokens;
+}
+
+static std::string Describe( const std::vector<std::string> &tokens )
+{
+	std::string out;
+
+	for( size_t i = 0; i < tokens.size(); i++ )
+		out += "[" + tokens[i] + "]";
+
+	return out;
+}
+
+static int CheckCorpus( void )
+{
+	int failed = 0;
+
+	for( size_t i = 0; i < sizeof( corpus ) / sizeof( corpus[0] ); i++ )
+	{
+		std::vector<std::string> tokens = Tokenize( corpus[i].input );
+
+		if( tokens == corpus[i].tokens )
+			continue;
+
+		printf( "FAIL %s\n  expected %s\n  got      %s\n", corpus[i].name, Describe( corpus[i].tokens ).c_str(), Describe( tokens ).c_str() );
+		failed++;
+	}
+
+	return failed;
+}
+
+// inputs are made of what matters to the tokenizer
+static std::string RandomInput( void )
+{
+	static const char alphabet[] = "ab1 \t\r\n{}()',/\"";
+	std::string out;
+	int len = rand() % RANDOM_MAX_LEN;
+
+	for( int i = 0; i < len; i++ )
+		out += alphabet[rand() % ( sizeof( alphabet ) - 1 )];
+
+	return out;
+}
+
+static int CheckRandom( void )
+{
+	srand( 12345 );
+
+	for( int i = 0; i < RANDOM_CASES; i++ )
+	{
+		std::string input = RandomInput();
+		std::string ours = input, theirs = input;
+		char *data = &ours[0], *ref = &theirs[0];
+		char token[PARSE_TOKEN_MAX];
+		bool quoted;
+
+		while( 1 )
+		{
+			data = ParseToken( data, token, &quoted );
+			ref = COM_Parse( ref );
+
+			// unterminated quote, COM_Parse went past the terminator and we stop at it
+			if( ref && ref - &theirs[0] > (int)input.size() )
+				ref = &theirs[input.size()];
+
+			if( !data != !ref || strcmp( token, com_token ) || quoted != com_quoted || ( data && data - &ours[0] != ref - &theirs[0] ))
+			{
+				printf( "FAIL random case %d: \"%s\"\n  ours [%s]%s, COM_Parse [%s]%s\n", i, input.c_str(),
+					token, quoted ? " quoted" : "", com_token, com_quoted ? " quoted" : "" );
+				return 1;
+			}
+
+			if( !data )
+				break;
+		}
+	}
+
+	return 0;
+}
+
+int main( void )
+{
+	int failed = CheckCorpus() + CheckRandom();
+
+	if( failed )
+	{
+		printf( "parse_test: %d failed\n", failed );
+		return 1;
+	}
+
+	printf( "parse_test: %d corpus and %d random cases passed\n", (int)( sizeof( corpus ) / sizeof( corpus[0] )), RANDOM_CASES );
+	return 0;
+}
@@ -0,0 +1,35 @@
+/*
+filesystem_metrics.h - extension interface of filesystem_stdio for I/O metrics
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FILESYSTEM_METRICS_H
+#define FILESYSTEM_METRICS_H
+
+#include "interface.h"
+
+// Taken from the same factory as IFileSystem. Not part of Valve's
+// filesystem, so ask for it only when CreateInterface returns it
+class IFileSystemMetrics : public IBaseInterface
+{
+public:
+	// write all counters as "name value" lines, NULL path for
+	// the file set by FS_STDIO_METRICS environment variable
+	virtual bool Dump( const char *path ) = 0;
+
+	// start counting from zero
+	virtual void Reset() = 0;
+};
+
+#define FILESYSTEM_METRICS_INTERFACE_VERSION "FileSystemMetrics001"
+
+#endif // FILESYSTEM_METRICS_H
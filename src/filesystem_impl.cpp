@@ -19,12 +19,38 @@ GNU General Public License for more details.
 #include <unistd.h>
 #include <stdarg.h>
 #include <time.h>
-#include "filesystem.h"
-
-typedef int qboolean;
-
-#include "fs_int.h"
-
+#include <sys/stat.h>
+#include <dirent.h>
+#include <strings.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include "fs_engine.h"
+#include "fs_handle.h"
+#include "fs_readbuf.h"
+#include "fs_lookup.h"
+#include "fs_index.h"
+#include "fs_prefetch.h"
+#include "fs_sched.h"
+#include "fs_levellog.h"
+#include "fs_registry.h"
+#include "fs_parse.h"
+#include "fs_mount.h"
+#include "fs_content.h"
+#include "fs_flush.h"
+#include "fs_pathid.h"
+#include "fs_pathtrie.h"
+#include "fs_watch.h"
+#include "fs_trace.h"
+#include "fs_metrics.h"
+#include "fs_stublog.h"
+
+// Thread safety: any call may come from any thread and different handles
+// may be used at the same time, but a single handle mustn't be used from
+// two threads at once. Lookups and opens work on a pinned snapshot of
+// search paths and never wait for them to be changed, all caches behind
+// them are sharded or locked on their own. Changes of search paths are
+// serialized by searchPathLock.
 class CXashFileSystem : public IFileSystem
 {
 public:
@@ -116,6 +142,20 @@ public:
 private:
 	bool IsGameDir( const char *pathID );
 
+	// search paths engine added in front of old head belong to pathID
+	void AssignPathID( searchpath_t *oldHead, const char *pathID );
+
+	// engine still has search paths removed by us
+	bool IsRemovedFile( const CSearchSnapshot *index, const char *name, bool gamedironly );
+	CFileHandle *OpenSource( const CSearchSnapshot *index, indexSource_t *source, const char *name, const char *options, const char *pathID, bool gamedironly );
+	CFileHandle *OpenDisk( const char *name, const char *options, const char *pathID, bool gamedironly );
+	CFileHandle *OpenPack( const char *name, const char *options, const char *pathID, bool gamedironly );
+	IFileBackend *OpenPackEntry( searchpath_t *search, const char *name );
+
+	struct findData_t *FindData( FileFindHandle_t handle );
+
+	std::vector<struct findData_t *> m_FindData;
+	std::mutex m_FindMutex;
 
 	bool m_bMounted;
 };
@@ -143,55 +183,105 @@ IFileSystem *filesystem( void )
 #define ENGINE_DLL "libxash.so"
 #endif
 
-class CEngine : public fs_api_t
+CEngine::CEngine()
 {
-public:
-	CEngine()
+	char path[PATH_MAX];
+	const char *library = getenv( ENGINE_LIBRARY_ENV );
+
+	// anything exporting FS_GetAPI will do, so library can be run without engine
+	if( library && *library )
+	{
+		snprintf( path, PATH_MAX, "%s", library );
+	}
+	else
 	{
-		char path[PATH_MAX];
 #ifdef __ANDROID__
 		snprintf( path, PATH_MAX, "%s/" ENGINE_DLL, getenv("XASH3D_ENGLIBDIR") );
 #else
 		snprintf( path, PATH_MAX, ENGINE_DLL );
 #endif
+	}
 
-		handle = dlopen( path, RTLD_NOW );
-
-		if( !handle )
-			abort();
+	handle = dlopen( path, RTLD_NOW );
 
-		pfnFS_GetAPI FS_GetAPI = (pfnFS_GetAPI)dlsym( handle, FS_API_EXPORT );
+	if( !handle )
+	{
+		fprintf( stderr, "FS_Stdio_Xash: can't load %s: %s\n", path, dlerror() );
+		abort();
+	}
 
-		if( !FS_GetAPI )
-			abort();
+	pfnFS_GetAPI FS_GetAPI = (pfnFS_GetAPI)dlsym( handle, FS_API_EXPORT );
 
-		FS_GetAPI( this );
+	if( !FS_GetAPI )
+	{
+		fprintf( stderr, "FS_Stdio_Xash: %s doesn't export " FS_API_EXPORT "\n", path );
+		abort();
 	}
 
-	~CEngine()
+	FS_GetAPI( this );
+	Serialize();
+}
+
+CEngine::~CEngine()
+{
+	dlclose( handle );
+}
+
+static std::mutex engineMutex;
+static fs_api_t engineAPI; // as engine gave it
+
+template<typename F> struct engineThunk_t;
+
+template<typename R, typename... Args> struct engineThunk_t<R (*)( Args... )>
+{
+	template<R (*fs_api_t::*func)( Args... )> static R Call( Args... args )
 	{
-		dlclose( handle );
+		std::lock_guard<std::mutex> lock( engineMutex );
+		return ( engineAPI.*func )( args... );
 	}
+};
 
-private:
-	void *handle;
-} engine;
+#define SERIALIZE( func ) func = &engineThunk_t<decltype( func )>::Call<&fs_api_t::func>
 
-#define Mem_Free( ptr ) engine._Mem_Free( (ptr), __FILE__, __LINE__ );
+void CEngine::Serialize()
+{
+	engineAPI = *this;
+
+	SERIALIZE( _Mem_Free );
+	SERIALIZE( FS_AddGameDirectory );
+	SERIALIZE( FS_Search );
+	SERIALIZE( FS_Open );
+	SERIALIZE( FS_Write );
+	SERIALIZE( FS_Read );
+	SERIALIZE( FS_Seek );
+	SERIALIZE( FS_Tell );
+	SERIALIZE( FS_Flush );
+	SERIALIZE( FS_Close );
+	SERIALIZE( FS_VPrintf );
+	SERIALIZE( FS_FileExists );
+	SERIALIZE( FS_FileTime );
+	SERIALIZE( FS_FileSize );
+	SERIALIZE( FS_GetDiskPath );
+	SERIALIZE( FS_CreatePath );
+	SERIALIZE( FS_FindFile );
+}
 
-#define STUBCALL( format, ... ) printf( "FS_Stdio_Xash: called a stub: %s  ->(" format ")\n" , __PRETTY_FUNCTION__, __VA_ARGS__ );
-#define STUBCALL_VOID			printf( "FS_Stdio_Xash: called a stub: %s  ->(void)\n", __PRETTY_FUNCTION__ );
+#undef SERIALIZE
 
-#ifndef NDEBUG
-#define LOGCALL( format, ... )	printf( "FS_Stdio_Xash: called %s     ->(" format ")\n" , __PRETTY_FUNCTION__, __VA_ARGS__ )
-#define LOGCALL_VOID			printf( "FS_Stdio_Xash: called %s     ->(void)\n", __PRETTY_FUNCTION__ );
+bool CEngine::GetDiskPath( const char *name, bool gamedironly, char *out, size_t size )
+{
+	std::lock_guard<std::mutex> lock( engineMutex );
+	const char *diskPath = engineAPI.FS_GetDiskPath( name, gamedironly );
 
-#define LOGRETVAL( format, ret ) printf( "FS_Stdio_Xash:             \-> " format "\n", ret );
-#else
-#define LOGCALL( format, ... )
-#define LOGCALL_VOID
-#define LOGRETVAL( format, ret )
-#endif
+	if( !diskPath || !size )
+		return false;
+
+	strncpy( out, diskPath, size );
+	out[size - 1] = 0;
+	return true;
+}
+
+CEngine engine;
 
 #ifdef _WIN32
 	const char CORRECT_PATH_SEPARATOR = '\\';
@@ -211,39 +301,276 @@ static void FixSlashes( char *str )
 	}
 }
 
+// Apply watcher events and search paths engine added behind our back,
+// unless they're being changed right now, and pin index for lookups
+static snapshotRef_t PinIndex()
+{
+	fileWatcher.Poll();
+
+	if( searchIndex.IsStale() )
+	{
+		std::unique_lock<std::mutex> pathLock( searchPathLock, std::try_to_lock );
+
+		if( pathLock.owns_lock() )
+			searchIndex.Sync();
+	}
+
+	return searchIndex.Pin();
+}
+
+// Like engine's FS_FixFileCase: components after start that don't exist
+// as they are take the case of an existing one, so "Config.cfg" writes
+// over "config.cfg" instead of creating a second file
+static void FixFileCase( char *path, size_t start )
+{
+	struct stat st;
+	char *comp = path + start;
+
+	while( *comp )
+	{
+		char *end = strchr( comp, '/' );
+
+		if( end )
+			*end = 0;
+
+		bool found = lstat( path, &st ) == 0;
+
+		if( !found )
+		{
+			comp[-1] = 0;
+
+			DIR *dir = opendir( comp == path + 1 ? "/" : path );
+			struct dirent *ent;
+
+			comp[-1] = '/';
+
+			while( dir && ( ent = readdir( dir )))
+			{
+				if( !strcasecmp( ent->d_name, comp ))
+				{
+					memcpy( comp, ent->d_name, strlen( comp ));
+					found = true;
+					break;
+				}
+			}
+
+			if( dir )
+				closedir( dir );
+		}
+
+		if( end )
+			*end = '/';
+
+		// nothing below it can exist either
+		if( !found || !end )
+			break;
+
+		comp = end + 1;
+	}
+}
+
+// Same place engine would write to: the last search path added without
+// FS_NOWRITE_PATH, it's the first of loose ones in engine order.
+// Directories on the way are created
+static bool WritePath( const char *name, char *out, size_t size )
+{
+	// engine refuses these
+	if( name[0] == '/' || name[0] == '\\' || strstr( name, ".." ) || strchr( name, ':' ))
+		return false;
+
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+	searchpath_t *search;
+
+	for( search = engine.FS_GetSearchPaths(); search; search = search->next )
+	{
+		if( !search->pack && !search->wad && !( search->flags & FS_NOWRITE_PATH ))
+			break;
+	}
+
+	if( !search )
+		return false;
+
+	size_t len = strlen( search->filename );
+	bool slash = len && search->filename[len - 1] != '/';
+
+	if( snprintf( out, size, "%s%s%s", search->filename, slash ? "/" : "", name ) >= (int)size )
+		return false;
+
+	FixSlashes( out );
+	FixFileCase( out, slash ? len + 1 : len );
+
+	for( char *p = out + len + 1; *p; p++ )
+	{
+		if( *p != '/' )
+			continue;
+
+		*p = 0;
+		mkdir( out, 0777 );
+		*p = '/';
+	}
+
+	return true;
+}
+
+// size and time of file written through us have changed
+static void FileWritten( const char *name )
+{
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+
+	searchIndex.Written( name );
+	lookupCache.Invalidate( name );
+	contentCache.Invalidate( name );
+}
+
 void CXashFileSystem::Mount()
 {
 	LOGCALL_VOID;
+	tracer.Start();
+	TRACECALL_VOID;
+	metrics.Start();
+	stubLog.Start();
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
 	m_bMounted = true;
+
+	searchIndex.Build();
+	contentCache.LoadBudget();
+	fileWatcher.Start();
+	writeFlusher.Start();
 }
 
 void CXashFileSystem::Unmount()
 {
 	LOGCALL_VOID;
 	m_bMounted = false;
+
+	prefetcher.Shutdown();
+	fileWatcher.Stop();
+	writeFlusher.Shutdown();
+
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+	searchIndex.Clear();
+	lookupCache.PrintStats();
+	contentCache.PrintStats();
+	contentCache.Flush();
+	handleRegistry.Report();
+	packMounts.Clear();
+	pathTrie.Flush();
+	pathIDs.Clear();
+
+	// last, so everything before is written out
+	stubLog.Shutdown();
+	metrics.Shutdown();
+	tracer.Shutdown();
 }
 
 void CXashFileSystem::RemoveAllSearchPaths( void )
 {
-	STUBCALL_VOID;
+	TRACECALL_VOID;
+	// engine can't drop it's search paths, so they are only hidden from our users
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+	searchIndex.RemoveAll();
+	packMounts.Clear();
+	pathIDs.Clear();
+	lookupCache.Flush();
+	contentCache.Flush();
+	pathTrie.Flush();
+	fileWatcher.Rewatch();
 }
 
 void CXashFileSystem::AddSearchPath(const char *pPath, const char *pathID)
 {
+	TRACECALL( pPath, pathID );
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+	searchpath_t *oldHead = engine.FS_GetSearchPaths();
+
 	engine.FS_AddGameDirectory( pPath, FS_CUSTOM_PATH );
+	AssignPathID( oldHead, pathID );
+	searchIndex.Sync();
+	lookupCache.Flush();
+	contentCache.Flush();
+	pathTrie.Flush();
+	fileWatcher.Rewatch();
 	LOGCALL("%s,%s", pPath, pathID );;
 }
 
 bool CXashFileSystem::RemoveSearchPath(const char *pPath)
 {
-	STUBCALL("%s", pPath);
-	return false;
+	TRACECALL( pPath );
+	if( !pPath )
+		return false;
+
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+
+	if( packMounts.Unmount( pPath ))
+	{
+		contentCache.Flush();
+		return true;
+	}
+
+	std::string dir = pPath;
+
+	while( !dir.empty() && ( dir[dir.size() - 1] == '/' || dir[dir.size() - 1] == '\\' ))
+		dir.erase( dir.size() - 1 );
+
+	if( dir.empty() )
+		return false;
+
+	// directory itself and packs engine found in it
+	std::vector<searchpath_t *> remove;
+
+	for( searchpath_t *search = engine.FS_GetSearchPaths(); search; search = search->next )
+	{
+		const char *filename = search->filename;
+
+		if( search->pack )
+		{
+			CPackFile *pack = Pack_ForSearchPath( search );
+
+			if( !pack )
+				continue;
+
+			filename = pack->Filename();
+		}
+		else if( search->wad )
+			continue;
+
+		if( strncmp( filename, dir.c_str(), dir.size() ) || filename[dir.size()] != '/' )
+			continue;
+
+		// not in a subdirectory
+		if( search->pack ? !strchr( filename + dir.size() + 1, '/' ) : !filename[dir.size() + 1] )
+			remove.push_back( search );
+	}
+
+	bool removed = false;
+
+	for( size_t i = 0; i < remove.size(); i++ )
+	{
+		std::vector<std::string> changed;
+
+		if( !searchIndex.Remove( remove[i], changed ))
+			continue;
+
+		// everything else is still taken from where it was
+		for( size_t j = 0; j < changed.size(); j++ )
+			lookupCache.Invalidate( changed[j].c_str() );
+
+		contentCache.Invalidate( changed );
+
+		pathTrie.Remove( remove[i] );
+		fileWatcher.Unwatch( remove[i] );
+		removed = true;
+	}
+
+	return removed;
 }
 
 void CXashFileSystem::RemoveFile(const char *pRelativePath, const char *pathID)
 {
+	TRACECALL( pRelativePath, pathID );
 	LOGCALL( "%s, %s", pRelativePath, pathID );
 
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
 	searchpath_t *path = engine.FS_FindFile( pRelativePath, NULL, true );
 
 	if( !path )
@@ -253,23 +580,52 @@ void CXashFileSystem::RemoveFile(const char *pRelativePath, const char *pathID)
 		return;
 
 	unlink( path->filename );
+	searchIndex.Update( pRelativePath );
+	lookupCache.Invalidate( pRelativePath );
+	contentCache.Invalidate( pRelativePath );
 }
 
 void CXashFileSystem::CreateDirHierarchy(const char *path, const char *pathID)
 {
+	TRACECALL( path, pathID );
 	char *pPath = strdup(path);
 	engine.FS_CreatePath(pPath);
+	lookupCache.Flush();
 
 	free(pPath);
 }
 
 bool CXashFileSystem::FileExists(const char *pFileName)
 {
-	return engine.FS_FindFile( pFileName, NULL, false ) != NULL;
+	TRACECALL( pFileName );
+	snapshotRef_t index = PinIndex();
+
+	if( index->Find( pFileName, false ))
+		return true;
+
+	if( !packMounts.IsEmpty() && packMounts.Find( pFileName, NULL, NULL ))
+		return true;
+
+	if( IsRemovedFile( index.get(), pFileName, false ))
+		return false;
+
+	return lookupCache.FileExists( pFileName, false );
 }
 
 bool CXashFileSystem::IsDirectory(const char *pFileName)
 {
+	TRACECALL( pFileName );
+	snapshotRef_t index = PinIndex();
+
+	if( index->IsDirectory( pFileName ))
+		return true;
+
+	if( !packMounts.IsEmpty() && packMounts.IsDirectory( pFileName, NULL ))
+		return true;
+
+	if( fileWatcher.Covers( pFileName ))
+		return lookupCache.IsDirectory( pFileName );
+
 	struct stat buf;
 	if( stat( pFileName, &buf ) != -1 )
 		return S_ISDIR( buf.st_mode );
@@ -278,51 +634,164 @@ bool CXashFileSystem::IsDirectory(const char *pFileName)
 
 FileHandle_t CXashFileSystem::Open(const char *pFileName, const char *pOptions, const char *pathID)
 {
+	TRACECALL( pFileName, pathID );
 	// SC 5.0 tries to parse this file and for some reason fails.
 	//if( strstr( pFileName, "materials.txt" ) )
 	//	return 0;
 
-	return engine.FS_Open( pFileName, pOptions, IsGameDir( pathID ));
+	CForegroundIO foreground;
+	CMetricTimer timer( METRIC_OPEN_TIME );
+	CFileHandle *handle;
+	bool writable = strpbrk( pOptions, "wa+" ) != NULL;
+	int id = pathIDs.Intern( pathID );
+	bool gamedironly = pathIDs.IsGameDir( id );
+
+	{
+		snapshotRef_t index = PinIndex();
+
+		handle = packMounts.IsEmpty() ? NULL : packMounts.Open( pFileName, pOptions, pathID, gamedironly );
+
+		// only search paths added with this pathID are looked at
+		if( !handle && !writable && pathIDs.IsScoped( id ) && index->IsActive() )
+		{
+			indexSource_t scratch;
+
+			handle = OpenSource( index.get(), index->FindIn( pFileName, pathIDs.Bit( id ), &scratch ), pFileName, pOptions, pathID, gamedironly );
+
+			if( !handle )
+				return FILESYSTEM_INVALID_HANDLE;
+		}
+		else if( !handle && !writable )
+		{
+			indexSource_t *source = index->Find( pFileName, gamedironly );
+
+			// indexed files are read without the engine, so they don't wait on each other.
+			// Loose ones are left to engine if asked to, unless it doesn't know they're hidden
+			if( source && ( CDiskBackend::IsEnabled() || source->origin != FILE_ORIGIN_LOOSE || index->HasRemoved() ))
+				handle = OpenSource( index.get(), source, pFileName, pOptions, pathID, gamedironly );
+
+			if( !handle && IsRemovedFile( index.get(), pFileName, gamedironly ))
+				return FILESYSTEM_INVALID_HANDLE;
+		}
+	}
+
+	// so are the rest of plain files, only paks and wads are left to engine
+	if( !handle && CDiskBackend::IsEnabled() )
+		handle = OpenDisk( pFileName, pOptions, pathID, gamedironly );
+
+	// paks index doesn't have are read by us as well, only wads are left to engine
+	if( !handle && !writable )
+		handle = OpenPack( pFileName, pOptions, pathID, gamedironly );
+
+	if( !handle )
+	{
+		file_t *native = engine.FS_Open( pFileName, pOptions, gamedironly );
+
+		if( !native )
+			return FILESYSTEM_INVALID_HANDLE;
+
+		handle = new CFileHandle( new CEngineBackend( native ), pFileName, pOptions, pathID, gamedironly );
+	}
+
+	if( handle->IsWritable() )
+		FileWritten( pFileName );
+
+	levelLog.Opened( handle );
+	handleRegistry.Opened( handle );
+
+	return handle;
 }
 
 void CXashFileSystem::Close( FileHandle_t file )
 {
-	engine.FS_Close( (file_t*)file );
+	TRACECALL( FileHandle( file ) );
+	if( !file )
+		return;
+
+	CFileHandle *handle = FileHandle( file );
+
+	handle->Close();
+	levelLog.Closed( handle );
+	handleRegistry.Closed( handle );
+
+	// size and time have changed
+	if( handle->IsWritable() )
+		FileWritten( handle->Name() );
+
+	delete handle;
 }
 
 void CXashFileSystem::Seek( FileHandle_t file, int pos, FileSystemSeek_t seekType )
 {
-	engine.FS_Seek( (file_t*)file, pos, seekType );
+	TRACECALL( FileHandle( file ) );
+	if( !file )
+		return;
+
+	FileHandle( file )->Seek( pos, seekType );
 }
 
 unsigned int CXashFileSystem::Tell(FileHandle_t file)
 {
-	return engine.FS_Tell( (file_t*)file );
+	TRACECALL( FileHandle( file ) );
+	if( !file )
+		return 0;
+
+	return FileHandle( file )->Tell();
 }
 
 unsigned int CXashFileSystem::Size(FileHandle_t file)
 {
-	fs_offset_t orig = engine.FS_Tell((file_t*)file);
-
-	engine.FS_Seek( (file_t*)file, 0, SEEK_END );
-	fs_offset_t size = engine.FS_Tell( (file_t*)file );
-	engine.FS_Seek( (file_t*)file, orig, SEEK_SET );
+	TRACECALL_NAMED( "SizeOfHandle", FileHandle( file ) );
+	if( !file )
+		return 0;
 
-	return size;
+	return FileHandle( file )->Size();
 }
 
 unsigned int CXashFileSystem::Size(const char *pFileName)
 {
-	return engine.FS_FileSize( pFileName, false );
+	TRACECALL_NAMED( "SizeOfFile", pFileName );
+	const packEntry_t *entry;
+	snapshotRef_t index = PinIndex();
+	std::shared_ptr<CPackFile> pack;
+
+	if( !packMounts.IsEmpty() && ( pack = packMounts.Find( pFileName, NULL, &entry )))
+		return entry->size;
+
+	indexSource_t *source = index->Find( pFileName, false );
+
+	if( source && index->Stat( source, pFileName ))
+		return source->size;
+
+	if( IsRemovedFile( index.get(), pFileName, false ))
+		return -1;
+
+	return lookupCache.FileSize( pFileName, false );
 }
 
 long CXashFileSystem::GetFileTime(const char *pFileName)
 {
-	return engine.FS_FileTime( pFileName, false );
+	TRACECALL( pFileName );
+	snapshotRef_t index = PinIndex();
+	std::shared_ptr<CPackFile> pack;
+
+	if( !packMounts.IsEmpty() && ( pack = packMounts.Find( pFileName, NULL, NULL )))
+		return pack->FileTime();
+
+	indexSource_t *source = index->Find( pFileName, false );
+
+	if( source && index->Stat( source, pFileName ))
+		return source->time;
+
+	if( IsRemovedFile( index.get(), pFileName, false ))
+		return -1;
+
+	return lookupCache.FileTime( pFileName, false );
 }
 
 void CXashFileSystem::FileTimeToString(char *pStrip, int maxCharsIncludingTerminator, long fileTime)
 {
+	TRACECALL_VOID;
 	time_t tFileTime = fileTime;
 	
 	strncpy( pStrip, ctime( &tFileTime ), maxCharsIncludingTerminator );
@@ -331,146 +800,241 @@ void CXashFileSystem::FileTimeToString(char *pStrip, int maxCharsIncludingTermin
 
 bool CXashFileSystem::IsOk(FileHandle_t file)
 {
-	file_t *nativeFile = (file_t*)file;
+	TRACECALL( FileHandle( file ) );
 	if( !file )
 	{
 		engine.Msg( "Tried to IsOk NULL");
 		return false;
 	}
 
-	// ferror()
-
-	return true;
+	return FileHandle( file )->IsOk();
 }
 
 void CXashFileSystem::Flush(FileHandle_t file)
 {
-	Seek( file, 0, FILESYSTEM_SEEK_HEAD );
+	TRACECALL( FileHandle( file ) );
+	if( !file )
+		return;
+
+	FileHandle( file )->Flush();
 }
 
 bool CXashFileSystem::EndOfFile(FileHandle_t file)
 {
-	return engine.FS_Eof( (file_t*) file );
+	TRACECALL( FileHandle( file ) );
+	if( !file )
+		return true;
+
+	return FileHandle( file )->Eof();
 }
 
 int CXashFileSystem::Read( void *pOutput, int size, FileHandle_t file )
 {
-	return engine.FS_Read( (file_t*)file, pOutput, size );
+	TRACECALL( FileHandle( file ) );
+	if( !file )
+		return 0;
+
+	CForegroundIO foreground;
+	CMetricTimer timer( METRIC_READ_TIME );
+	int read = FileHandle( file )->Read( pOutput, size );
+
+	if( read > 0 )
+		metrics.Add( METRIC_BYTES_READ, read );
+
+	return trace.Bytes( read );
 }
 
 int CXashFileSystem::Write(const void *pInput, int size, FileHandle_t file)
 {
-	return engine.FS_Write( (file_t*)file, pInput, size );
+	TRACECALL( FileHandle( file ) );
+	if( !file )
+		return 0;
+
+	int written = FileHandle( file )->Write( pInput, size );
+
+	if( written > 0 )
+		metrics.Add( METRIC_BYTES_WRITTEN, written );
+
+	return trace.Bytes( written );
 }
 
 char *CXashFileSystem::ReadLine(char *pOutput, int maxChars, FileHandle_t file)
 {
-	file_t *nativeFile = (file_t*)file;
-
-	if( engine.FS_Eof( nativeFile ) )
+	TRACECALL( FileHandle( file ) );
+	if( !file )
 		return NULL;
 
-	char *p = pOutput;
-	*p = 0;
-	for( int i = 0; i < maxChars; i++ )
-	{
-		*p = engine.FS_Getc( nativeFile );
+	CForegroundIO foreground;
+	char *line = FileHandle( file )->ReadLine( pOutput, maxChars );
 
-		if( *p == '\n' || *p == -1 )
-			break;
-
-		p++;
-	}
+	if( line )
+		metrics.Add( METRIC_BYTES_READ, trace.Bytes( strlen( line )));
 
-
-	if( p != pOutput && *(p-1) == '\r' )
-		*(p-1) = 0;
-	else *p = 0;
-	return pOutput;
+	return line;
 }
 
 int CXashFileSystem::FPrintf(FileHandle_t file, const char *pFormat, ...)
 {
+	TRACECALL( FileHandle( file ) );
 	int	result;
 	va_list	args;
 
+	if( !file )
+		return 0;
+
 	va_start( args, pFormat );
-	result = engine.FS_VPrintf( (file_t*)file, pFormat, args );
+	result = FileHandle( file )->VPrintf( pFormat, args );
 	va_end( args );
 
-	return result;
+	if( result > 0 )
+		metrics.Add( METRIC_BYTES_WRITTEN, result );
+
+	return trace.Bytes( result );
 }
 
 void *CXashFileSystem::GetReadBuffer(FileHandle_t file, int *outBufferSize, bool failIfNotInCache)
 {
-	// engine.FS_LoadFile?
-	STUBCALL_VOID;
-	return NULL;
+	TRACECALL( FileHandle( file ) );
+	if( !file )
+		return NULL;
+
+	void *buffer = readBufferCache.Acquire( FileHandle( file ), outBufferSize, failIfNotInCache );
+
+	if( buffer && outBufferSize )
+		metrics.Add( METRIC_BYTES_READ, trace.Bytes( *outBufferSize ));
+
+	return buffer;
 }
 
 void CXashFileSystem::ReleaseReadBuffer(FileHandle_t file, void *readBuffer)
 {
-	// engine.FS_CloseFile?
-	STUBCALL_VOID
-	return;
+	TRACECALL( FileHandle( file ) );
+	if( !file || !readBuffer )
+		return;
+
+	readBufferCache.Release( FileHandle( file ), readBuffer );
 }
 
 struct findData_t
 {
-	search_t *search;
-	int iter;
+	std::vector<std::string> names;
+	size_t iter;
 };
 
 const char *CXashFileSystem::FindFirst(const char *pWildCard, FileFindHandle_t *pHandle, const char *pathID)
 {
+	TRACECALL( pWildCard, pathID );
+	CMetricTimer timer( METRIC_FIND_TIME );
+
 	if( !pHandle )
 		return NULL;
 
+	*pHandle = FILESYSTEM_INVALID_FIND_HANDLE;
+
 	findData_t *ptr = new findData_t;
+	int id = pathIDs.Intern( pathID );
+	bool gamedironly = pathIDs.IsGameDir( id );
+
 	if( pWildCard[0] == '/' ) pWildCard++;
-	ptr->search = engine.FS_Search( pWildCard, false, IsGameDir( pathID) );
+	ptr->iter = 0;
 
-	if( !ptr->search )
+	{
+		snapshotRef_t index = PinIndex();
+
+		// only search paths added with this pathID are looked at, like in Open
+		pathIDMask_t scope = pathIDs.IsScoped( id ) && index->IsActive() ? pathIDs.Bit( id ) : 0;
+
+		if( !index->Search( pWildCard, gamedironly, ptr->names, scope ))
+		{
+			search_t *search = engine.FS_Search( pWildCard, false, gamedironly );
+
+			if( search )
+			{
+				for( int i = 0; i < search->numfilenames; i++ )
+				{
+					if( scope && !index->HasIn( search->filenames[i], scope ))
+						continue;
+
+					if( !IsRemovedFile( index.get(), search->filenames[i], gamedironly ))
+						ptr->names.push_back( search->filenames[i] );
+				}
+
+				Mem_Free( search );
+			}
+		}
+
+		if( !packMounts.IsEmpty() )
+			packMounts.Search( pWildCard, pathID, gamedironly, ptr->names );
+	}
+
+	if( ptr->names.empty() )
 	{
 		delete ptr;
 		return NULL;
 	}
-	ptr->iter = 0;
 
-	*pHandle = (int)ptr; // I am so sorry
+	std::unique_lock<std::mutex> lock( m_FindMutex );
+
+	// reuse closed handles
+	size_t i;
+	for( i = 0; i < m_FindData.size() && m_FindData[i]; i++ );
+
+	if( i == m_FindData.size() )
+		m_FindData.push_back( ptr );
+	else m_FindData[i] = ptr;
+
+	*pHandle = i;
+	lock.unlock();
+
 	return FindNext( *pHandle );
 }
 
 const char *CXashFileSystem::FindNext(FileFindHandle_t handle)
 {
-	findData_t *ptr = (findData_t *)handle;
-	return ptr->search->filenames[ptr->iter++];
+	TRACECALL_VOID;
+	findData_t *ptr = FindData( handle );
+
+	if( !ptr || ptr->iter >= ptr->names.size() )
+		return NULL;
+
+	return ptr->names[ptr->iter++].c_str();
 }
 
 bool CXashFileSystem::FindIsDirectory(FileFindHandle_t handle)
 {
-	findData_t *ptr = (findData_t *)handle;
-	return IsDirectory( ptr->search->filenames[ptr->iter] );
+	TRACECALL_VOID;
+	findData_t *ptr = FindData( handle );
+
+	// last returned name
+	if( !ptr || !ptr->iter )
+		return false;
+
+	return IsDirectory( ptr->names[ptr->iter - 1].c_str() );
 }
 
 void CXashFileSystem::FindClose(FileFindHandle_t handle)
 {
-	findData_t *ptr = (findData_t *)handle;
+	TRACECALL_VOID;
+	findData_t *ptr = FindData( handle );
 
-	if( ptr->search )
-		Mem_Free( ptr->search );
+	if( !ptr )
+		return;
+
+	std::lock_guard<std::mutex> lock( m_FindMutex );
+	m_FindData[handle] = NULL;
 	delete ptr;
-	return;
 }
 
 void CXashFileSystem::GetLocalCopy(const char *pFileName)
 {
+	TRACECALL( pFileName );
 	STUBCALL("%s", pFileName );
 	return;
 }
 
 const char* CXashFileSystem::GetLocalPath(const char *pFileName, char *pLocalPath, int localPathBufferSize)
 {
+	TRACECALL( pFileName );
 	// Is it an absolute path?
 #ifdef _WIN32
 	if ( strchr( pFileName, ':' ) )
@@ -485,82 +1049,44 @@ const char* CXashFileSystem::GetLocalPath(const char *pFileName, char *pLocalPat
 		return pLocalPath;
 	}
 
-	const char *diskPath = engine.FS_GetDiskPath( pFileName, false );
+	snapshotRef_t index = PinIndex();
+	indexSource_t *source = index->Find( pFileName, false );
 
-	if( diskPath )
+	if( source && source->origin == FILE_ORIGIN_LOOSE )
 	{
-		strncpy( pLocalPath, diskPath, localPathBufferSize );
-		pLocalPath[localPathBufferSize-1] = 0;
+		if( index->DiskPath( source, pFileName, pLocalPath, localPathBufferSize ))
+			return pLocalPath;
+	}
 
+	if( engine.GetDiskPath( pFileName, false, pLocalPath, localPathBufferSize ))
 		return pLocalPath;
-	}
 	return NULL;
 }
 
 char *CXashFileSystem::ParseFile(char *pFileBytes, char *pToken, bool *pWasQuoted)
 {
-	STUBCALL_VOID; // nothing safe to read
-	return 0;
+	TRACECALL_VOID;
+	return ParseToken( pFileBytes, pToken, pWasQuoted );
 }
 
 bool CXashFileSystem::FullPathToRelativePath(const char *pFullpath, char *pRelative)
 {
-	bool success = false;
+	TRACECALL( pFullpath );
+	std::string relative;
 
-	if( !pFullpath[0] )
+	if( !pFullpath[0] || !pathTrie.Relative( pFullpath, relative ))
 	{
 		pRelative[0] = 0;
-		return success;
-	}
-
-	char *fullpath = realpath( pFullpath, NULL );
-	searchpath_t *sp = engine.FS_GetSearchPaths();
-	char *real = NULL;
-
-	for( sp; sp; sp = sp->next )
-	{
-		if( sp->wad || sp->pack )
-			continue;
-
-		real = realpath( sp->filename, 0 );
-
-		if( !real )
-			continue; // is this possible?
-
-		if( !strncmp( fullpath, real, strlen( real )))
-		{
-			break;
-		}
-		else
-		{
-			free( real );
-			real = NULL;
-		}
-	}
-
-	if( real )
-	{
-		int slen = strlen( real );
-
-		int i;
-		for( i = 0; i < slen; i++ )
-		{
-			if( real[i] != fullpath[i] )
-				break;
-		}
-
-		strcpy( pRelative, fullpath + i + 1 );
-
-		free( real );
+		return false;
 	}
 
-	free( fullpath );
-
+	strcpy( pRelative, relative.c_str() );
 	return true;
 }
 
 bool CXashFileSystem::GetCurrentDirectory(char *pDirectory, int maxlen)
 {
+	TRACECALL_VOID;
 #ifdef _WIN32
 	if ( !::GetCurrentDirectoryA( maxlen, pDirectory ) )
 #elif __linux__
@@ -580,103 +1106,155 @@ bool CXashFileSystem::GetCurrentDirectory(char *pDirectory, int maxlen)
 
 void CXashFileSystem::PrintOpenedFiles()
 {
-	STUBCALL_VOID;
+	TRACECALL_VOID;
+	handleRegistry.PrintOpened();
 }
 
 void CXashFileSystem::SetWarningFunc(void (*pfnWarning)(const char *, ...))
 {
-	STUBCALL_VOID;
+	TRACECALL_VOID;
+	handleRegistry.SetWarningFunc( pfnWarning );
 }
 
 void CXashFileSystem::SetWarningLevel(FileWarningLevel_t level)
 {
-	STUBCALL("%i", level);
+	TRACECALL_VOID;
+	handleRegistry.SetWarningLevel( level );
 }
 
 void CXashFileSystem::LogLevelLoadStarted(const char *name)
 {
-	STUBCALL("%s", name);
+	TRACECALL( name );
+	levelLog.Start( name );
 }
 
 void CXashFileSystem::LogLevelLoadFinished(const char *name)
 {
-	STUBCALL("%s",name);
+	TRACECALL( name );
+	// writes the log and updates index
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+	levelLog.Finish( name );
 }
 
 int CXashFileSystem::HintResourceNeed(const char *hintlist, int forgetEverything)
 {
-	STUBCALL("%s, %i", hintlist, forgetEverything );
-	return 0;
+	TRACECALL( hintlist );
+	LOGCALL("%s, %i", hintlist, forgetEverything );
+	return prefetcher.Hint( hintlist, forgetEverything != 0 );
 }
 
 int CXashFileSystem::PauseResourcePreloading()
 {
-	STUBCALL_VOID;
-	return 0;
+	TRACECALL_VOID;
+	return ioScheduler.Pause();
 }
 
 int CXashFileSystem::ResumeResourcePreloading()
 {
-	STUBCALL_VOID;
-	return 0;
+	TRACECALL_VOID;
+	return ioScheduler.Resume();
 }
 
 int CXashFileSystem::SetVBuf(FileHandle_t stream, char *buffer, int mode, long size)
 {
-	STUBCALL("%p", stream);
-	return 0;
+	TRACECALL( FileHandle( stream ) );
+	if( !stream )
+		return -1;
+
+	return FileHandle( stream )->SetVBuf( buffer, mode, size );
 }
 
 void CXashFileSystem::GetInterfaceVersion(char *p, int maxlen)
 {
+	TRACECALL_VOID;
 	*p = 0;
 	strncat( p, "Stdio", maxlen );
 }
 
 bool CXashFileSystem::IsFileImmediatelyAvailable(const char *pFileName)
 {
+	TRACECALL( pFileName );
 	return true; // local, so available immediately
 }
 
 WaitForResourcesHandle_t CXashFileSystem::WaitForResources(const char *resourcelist)
 {
-	STUBCALL("%s", resourcelist);
-	return 0;
+	TRACECALL( resourcelist );
+	LOGCALL("%s", resourcelist);
+	return prefetcher.Wait( resourcelist );
 }
 
 bool CXashFileSystem::GetWaitForResourcesProgress(WaitForResourcesHandle_t handle, float *progress, bool *complete)
 {
-	STUBCALL_VOID;
-	return false;
+	TRACECALL_VOID;
+	return prefetcher.Progress( handle, progress, complete );
 }
 
 void CXashFileSystem::CancelWaitForResources(WaitForResourcesHandle_t handle)
 {
-	STUBCALL_VOID;
-	return;
+	TRACECALL_VOID;
+	prefetcher.Cancel( handle );
 }
 
 bool CXashFileSystem::IsAppReadyForOfflinePlay(int appID)
 {
+	TRACECALL_VOID;
 	STUBCALL("%i", appID);
 	return true;
 }
 
 bool CXashFileSystem::AddPackFile(const char *fullpath, const char *pathID)
 {
-	STUBCALL("%s, %s", fullpath, pathID );
-	return false;
+	TRACECALL( fullpath, pathID );
+	if( !fullpath )
+		return false;
+
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+
+	if( !packMounts.Mount( fullpath, pathID ))
+		return false;
+
+	contentCache.Flush();
+	return true;
 }
 
 FileHandle_t CXashFileSystem::OpenFromCacheForRead(const char *pFileName, const char *pOptions, const char *pathID)
 {
-	LOGCALL( "%s, %s, %s", pFileName, pOptions, pathID );
-	return Open( pFileName, pOptions, pathID );
+	TRACECALL( pFileName, pathID );
+	// only read-only files can be kept
+	if( strpbrk( pOptions, "wa+" ))
+		return Open( pFileName, pOptions, pathID );
+
+	CFileHandle *handle = contentCache.Open( pFileName, pOptions, pathID, IsGameDir( pathID ));
+
+	if( handle )
+	{
+		levelLog.Opened( handle );
+		handleRegistry.Opened( handle );
+		return handle;
+	}
+
+	handle = FileHandle( Open( pFileName, pOptions, pathID ));
+
+	if( handle )
+		contentCache.Insert( handle );
+
+	return handle;
 }
 
 void CXashFileSystem::AddSearchPathNoWrite(const char *pPath, const char *pathID)
 {
+	TRACECALL( pPath, pathID );
+	std::lock_guard<std::mutex> pathLock( searchPathLock );
+	searchpath_t *oldHead = engine.FS_GetSearchPaths();
+
 	engine.FS_AddGameDirectory( pPath, FS_CUSTOM_PATH | FS_NOWRITE_PATH );
+	AssignPathID( oldHead, pathID );
+	searchIndex.Sync();
+	lookupCache.Flush();
+	contentCache.Flush();
+	pathTrie.Flush();
+	fileWatcher.Rewatch();
 
 	LOGCALL("%s, %s", pPath, pathID);
 }
@@ -692,15 +1270,115 @@ CXashFileSystem::CXashFileSystem()
 
 bool CXashFileSystem::IsGameDir(const char *pathID)
 {
-	bool gamedironly = false;
+	return pathIDs.IsGameDir( pathIDs.Intern( pathID ));
+}
+
+void CXashFileSystem::AssignPathID( searchpath_t *oldHead, const char *pathID )
+{
+	int id = pathIDs.Intern( pathID );
+
+	for( searchpath_t *search = engine.FS_GetSearchPaths(); search && search != oldHead; search = search->next )
+		pathIDs.Assign( id, search );
+}
+
+bool CXashFileSystem::IsRemovedFile( const CSearchSnapshot *index, const char *name, bool gamedironly )
+{
+	if( !index->HasRemoved() )
+		return false;
+
+	return lookupCache.IsRemoved( index, name, gamedironly );
+}
+
+CFileHandle *CXashFileSystem::OpenSource( const CSearchSnapshot *index, indexSource_t *source, const char *name, const char *options, const char *pathID, bool gamedironly )
+{
+	IFileBackend *backend = NULL;
+
+	if( !source )
+		return NULL;
+
+	if( source->origin == FILE_ORIGIN_PAK )
+	{
+		backend = OpenPackEntry( source->search, name );
+	}
+	else
+	{
+		char path[MAX_SYSPATH];
+
+		if( index->DiskPath( source, name, path, sizeof( path )))
+			backend = CDiskBackend::Open( path, options );
+	}
+
+	if( !backend )
+		return NULL;
+
+	CFileHandle *handle = new CFileHandle( backend, name, options, pathID, gamedironly );
+
+	handle->SetSource( source->search, source->origin );
+	return handle;
+}
+
+// stored entries are read in place, only compressed ones are unpacked to memory
+IFileBackend *CXashFileSystem::OpenPackEntry( searchpath_t *search, const char *name )
+{
+	CPackFile *pack = Pack_ForSearchPath( search );
+	const packEntry_t *entry = pack ? pack->FindEntry( name ) : NULL;
+
+	if( !entry )
+		return NULL;
+
+	long offset = pack->StoredOffset( entry );
+
+	if( offset >= 0 )
+		return CPackBackend::Open( pack->Handle(), offset, entry->size );
+
+	void *data = pack->ReadEntry( entry );
+
+	return data ? new CMemoryBackend( data, entry->size ) : NULL;
+}
+
+// pak entry found like engine would
+CFileHandle *CXashFileSystem::OpenPack( const char *name, const char *options, const char *pathID, bool gamedironly )
+{
+	searchpath_t *search = engine.FS_FindFile( name, NULL, gamedironly );
+	IFileBackend *backend = OpenPackEntry( search, name );
+
+	if( !backend )
+		return NULL;
 
-	if( pathID && (strstr( pathID, "GAME" ) || strstr( pathID, "BASE" )))
-		gamedironly = true;
+	CFileHandle *handle = new CFileHandle( backend, name, options, pathID, gamedironly );
 
-	return gamedironly;
+	handle->SetSource( search, FILE_ORIGIN_PAK );
+	return handle;
 }
 
+// plain file found like engine would, or created where engine would
+CFileHandle *CXashFileSystem::OpenDisk( const char *name, const char *options, const char *pathID, bool gamedironly )
+{
+	char path[MAX_SYSPATH];
 
+	if( strpbrk( options, "wa+" ))
+	{
+		if( !WritePath( name, path, sizeof( path )))
+			return NULL;
+	}
+	else if( !engine.GetDiskPath( name, gamedironly, path, sizeof( path )))
+		return NULL;
+
+	CDiskBackend *backend = CDiskBackend::Open( path, options );
+
+	if( !backend )
+		return NULL;
 
+	return new CFileHandle( backend, name, options, pathID, gamedironly );
+}
 
+findData_t *CXashFileSystem::FindData( FileFindHandle_t handle )
+{
+	// other threads may be growing it
+	std::lock_guard<std::mutex> lock( m_FindMutex );
 
+	if( handle < 0 || (size_t)handle >= m_FindData.size() )
+		return NULL;
+
+	return m_FindData[handle];
+}
@@ -0,0 +1,227 @@
+/*
+fs_backend.cpp - where file handle data comes from
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fs_backend.h"
+
+// same as engine, can't seek past the end
+static int SeekTarget( fs_offset_t pos, fs_offset_t size, fs_offset_t offset, int whence, fs_offset_t *target )
+{
+	switch( whence )
+	{
+	case SEEK_SET: *target = offset; break;
+	case SEEK_CUR: *target = pos + offset; break;
+	case SEEK_END: *target = size + offset; break;
+	default: return -1;
+	}
+
+	return *target < 0 || *target > size ? -1 : 0;
+}
+
+CMemoryBackend::~CMemoryBackend()
+{
+	free( m_pData );
+}
+
+fs_offset_t CMemoryBackend::Read( void *buffer, size_t size )
+{
+	fs_offset_t left = m_iSize - m_iPos;
+
+	if( (fs_offset_t)size > left )
+		size = left;
+
+	memcpy( buffer, m_pData + m_iPos, size );
+	m_iPos += size;
+
+	return size;
+}
+
+int CMemoryBackend::Seek( fs_offset_t offset, int whence )
+{
+	fs_offset_t target;
+
+	if( SeekTarget( m_iPos, m_iSize, offset, whence, &target ) < 0 )
+		return -1;
+
+	m_iPos = target;
+	return 0;
+}
+
+bool CDiskBackend::IsEnabled()
+{
+	static const char *env = getenv( NATIVE_IO_ENV );
+	static bool enabled = !env || strcmp( env, "0" );
+
+	return enabled;
+}
+
+CDiskBackend *CDiskBackend::Open( const char *path, const char *mode )
+{
+	bool update = strchr( mode, '+' ) != NULL;
+	int flags;
+
+	// kernel puts appends at the real end, other handles and
+	// processes may be writing to the same log
+	if( strchr( mode, 'w' ))
+		flags = ( update ? O_RDWR : O_WRONLY ) | O_CREAT | O_TRUNC;
+	else if( strchr( mode, 'a' ))
+		flags = ( update ? O_RDWR : O_WRONLY ) | O_CREAT | O_APPEND;
+	else flags = update ? O_RDWR : O_RDONLY;
+
+	int handle = open( path, flags | O_CLOEXEC, 0666 );
+	struct stat st;
+
+	if( handle < 0 )
+		return NULL;
+
+	if( fstat( handle, &st ) < 0 || !S_ISREG( st.st_mode ))
+	{
+		close( handle );
+		return NULL;
+	}
+
+	return new CDiskBackend( handle, st.st_size, strchr( mode, 'a' ) != NULL );
+}
+
+CDiskBackend::~CDiskBackend()
+{
+	close( m_iHandle );
+}
+
+fs_offset_t CDiskBackend::Read( void *buffer, size_t size )
+{
+	ssize_t n = pread( m_iHandle, buffer, size, m_iPos );
+
+	if( n > 0 )
+		m_iPos += n;
+
+	return n;
+}
+
+fs_offset_t CDiskBackend::Write( const void *buffer, size_t size )
+{
+	const char *data = (const char *)buffer;
+	size_t done = 0;
+
+	while( done < size )
+	{
+		// pwrite ignores the offset with O_APPEND on Linux only
+		ssize_t n = m_bAppend ? write( m_iHandle, data + done, size - done ) : pwrite( m_iHandle, data + done, size - done, m_iPos + done );
+
+		if( n <= 0 )
+			break;
+
+		done += n;
+	}
+
+	// end of file may have been moved by someone else
+	if( m_bAppend )
+	{
+		off_t end = lseek( m_iHandle, 0, SEEK_CUR );
+
+		if( end >= 0 )
+			m_iPos = end;
+	}
+	else m_iPos += done;
+
+	if( m_iPos > m_iSize )
+		m_iSize = m_iPos;
+
+	return done || !size ? (fs_offset_t)done : -1;
+}
+
+int CDiskBackend::VPrintf( const char *format, va_list args )
+{
+	char small[1024];
+	va_list copy;
+
+	va_copy( copy, args );
+	int len = vsnprintf( small, sizeof( small ), format, copy );
+	va_end( copy );
+
+	if( len < 0 )
+		return -1;
+
+	if( len < (int)sizeof( small ))
+		return Write( small, len );
+
+	char *large = (char *)malloc( len + 1 );
+
+	if( !large )
+		return -1;
+
+	vsnprintf( large, len + 1, format, args );
+	len = Write( large, len );
+	free( large );
+
+	return len;
+}
+
+int CDiskBackend::Seek( fs_offset_t offset, int whence )
+{
+	fs_offset_t target;
+
+	if( SeekTarget( m_iPos, m_iSize, offset, whence, &target ) < 0 )
+		return -1;
+
+	m_iPos = target;
+	return 0;
+}
+
+CPackBackend *CPackBackend::Open( int packHandle, fs_offset_t offset, fs_offset_t size )
+{
+	// pack may be dropped while entry is still open
+	int handle = fcntl( packHandle, F_DUPFD_CLOEXEC, 0 );
+
+	if( handle < 0 )
+		return NULL;
+
+	return new CPackBackend( handle, offset, size );
+}
+
+CPackBackend::~CPackBackend()
+{
+	close( m_iHandle );
+}
+
+fs_offset_t CPackBackend::Read( void *buffer, size_t size )
+{
+	fs_offset_t left = m_iSize - m_iPos;
+
+	if( (fs_offset_t)size > left )
+		size = left;
+
+	ssize_t n = pread( m_iHandle, buffer, size, m_iOffset + m_iPos );
+
+	if( n > 0 )
+		m_iPos += n;
+
+	return n;
+}
+
+int CPackBackend::Seek( fs_offset_t offset, int whence )
+{
+	fs_offset_t target;
+
+	if( SeekTarget( m_iPos, m_iSize, offset, whence, &target ) < 0 )
+		return -1;
+
+	m_iPos = target;
+	return 0;
+}
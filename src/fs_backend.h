@@ -0,0 +1,134 @@
+/*
+fs_backend.h - where file handle data comes from
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_BACKEND_H
+#define FS_BACKEND_H
+
+#include <stdarg.h>
+#include "fs_engine.h"
+
+#define NATIVE_IO_ENV "FS_STDIO_NATIVE" // set to 0 to leave all loose files to engine
+
+// Raw I/O under CFileHandle, which does buffering and bookkeeping.
+// Semantics follow engine's FS_* calls. Deleting closes the file
+class IFileBackend
+{
+public:
+	virtual ~IFileBackend() { }
+
+	virtual fs_offset_t Read( void *buffer, size_t size ) = 0;
+	virtual fs_offset_t Write( const void *buffer, size_t size ) = 0;
+	virtual int VPrintf( const char *format, va_list args ) = 0;
+	virtual int Seek( fs_offset_t offset, int whence ) = 0;
+	virtual fs_offset_t Tell() = 0;
+	virtual int Flush() = 0;
+
+	// engine file, if it's the engine who does I/O
+	virtual file_t *Native() { return NULL; }
+};
+
+// engine's file_t
+class CEngineBackend : public IFileBackend
+{
+public:
+	CEngineBackend( file_t *file ) : m_pFile( file ) { }
+	~CEngineBackend() { engine.FS_Close( m_pFile ); }
+
+	fs_offset_t Read( void *buffer, size_t size ) { return engine.FS_Read( m_pFile, buffer, size ); }
+	fs_offset_t Write( const void *buffer, size_t size ) { return engine.FS_Write( m_pFile, buffer, size ); }
+	int VPrintf( const char *format, va_list args ) { return engine.FS_VPrintf( m_pFile, format, args ); }
+	int Seek( fs_offset_t offset, int whence ) { return engine.FS_Seek( m_pFile, offset, whence ); }
+	fs_offset_t Tell() { return engine.FS_Tell( m_pFile ); }
+	int Flush() { return engine.FS_Flush( m_pFile ); }
+
+	file_t *Native() { return m_pFile; }
+
+private:
+	file_t *m_pFile;
+};
+
+// read-only file held in memory, takes ownership of malloc'ed data
+class CMemoryBackend : public IFileBackend
+{
+public:
+	CMemoryBackend( void *data, fs_offset_t size ) : m_pData( (char *)data ), m_iSize( size ), m_iPos( 0 ) { }
+	~CMemoryBackend();
+
+	fs_offset_t Read( void *buffer, size_t size );
+	fs_offset_t Write( const void *, size_t ) { return -1; }
+	int VPrintf( const char *, va_list ) { return -1; }
+	int Seek( fs_offset_t offset, int whence );
+	fs_offset_t Tell() { return m_iPos; }
+	int Flush() { return 0; }
+
+private:
+	char *m_pData;
+	fs_offset_t m_iSize;
+	fs_offset_t m_iPos;
+};
+
+// loose file opened by us instead of the engine, with pread and pwrite
+// on our own descriptor, so there's no engine buffer to copy through
+class CDiskBackend : public IFileBackend
+{
+public:
+	// fopen style mode, NULL if it can't be opened
+	static CDiskBackend *Open( const char *path, const char *mode );
+	~CDiskBackend();
+
+	// unless disabled by NATIVE_IO_ENV
+	static bool IsEnabled();
+
+	fs_offset_t Read( void *buffer, size_t size );
+	fs_offset_t Write( const void *buffer, size_t size );
+	int VPrintf( const char *format, va_list args );
+	int Seek( fs_offset_t offset, int whence );
+	fs_offset_t Tell() { return m_iPos; }
+	int Flush() { return 0; } // nothing is kept by us
+
+private:
+	CDiskBackend( int handle, fs_offset_t size, bool append ) : m_iHandle( handle ), m_iSize( size ), m_iPos( 0 ), m_bAppend( append ) { }
+
+	int m_iHandle;
+	fs_offset_t m_iSize;
+	fs_offset_t m_iPos;
+	bool m_bAppend; // every write goes to the end
+};
+
+// stored pack entry read with pread on our own copy of pack's descriptor,
+// so it neither goes through the engine nor is kept in memory
+class CPackBackend : public IFileBackend
+{
+public:
+	// NULL if descriptor can't be duplicated
+	static CPackBackend *Open( int packHandle, fs_offset_t offset, fs_offset_t size );
+	~CPackBackend();
+
+	fs_offset_t Read( void *buffer, size_t size );
+	fs_offset_t Write( const void *, size_t ) { return -1; }
+	int VPrintf( const char *, va_list ) { return -1; }
+	int Seek( fs_offset_t offset, int whence );
+	fs_offset_t Tell() { return m_iPos; }
+	int Flush() { return 0; }
+
+private:
+	CPackBackend( int handle, fs_offset_t offset, fs_offset_t size ) : m_iHandle( handle ), m_iOffset( offset ), m_iSize( size ), m_iPos( 0 ) { }
+
+	int m_iHandle;
+	fs_offset_t m_iOffset; // of entry data in the pack
+	fs_offset_t m_iSize;
+	fs_offset_t m_iPos;
+};
+
+#endif // FS_BACKEND_H
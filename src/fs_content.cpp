@@ -0,0 +1,308 @@
+/*
+fs_content.cpp - in-memory cache of small read-only files
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "fs_content.h"
+
+CContentCache contentCache;
+
+// mounted archives are picked by pathID, so it's a part of the key
+static void MakeKey( std::string &key, const char *name, const char *pathID, bool gamedironly )
+{
+	key.clear();
+	key += gamedironly ? '1' : '0';
+	key += pathID ? pathID : "";
+	key += ':';
+
+	for( ; *name; name++ )
+	{
+		char c = *name == '\\' ? '/' : *name;
+
+		if( c == '/' && key[key.size() - 1] == '/' )
+			continue;
+
+		key += c;
+	}
+}
+
+static void LowerCase( std::string &str )
+{
+	for( size_t i = 0; i < str.size(); i++ )
+		str[i] = tolower( str[i] );
+}
+
+void CContentCache::SetBudget( size_t budget )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	m_iBudget = budget;
+	Evict( 0 );
+}
+
+void CContentCache::LoadBudget()
+{
+	const char *env = getenv( CONTENT_BUDGET_ENV );
+
+	if( !env || !*env )
+		return;
+
+	char *end;
+	long long budget = strtoll( env, &end, 10 );
+
+	if( *end == 'k' || *end == 'K' )
+		budget *= 1024;
+	else if( *end == 'm' || *end == 'M' )
+		budget *= 1024 * 1024;
+
+	if( budget >= 0 )
+		SetBudget( budget );
+}
+
+CFileHandle *CContentCache::Open( const char *name, const char *options, const char *pathID, bool gamedironly )
+{
+	std::string key;
+
+	MakeKey( key, name, pathID, gamedironly );
+
+	std::unique_lock<std::mutex> lock( m_Mutex );
+	std::unordered_map<std::string, std::list<contentEntry_t>::iterator>::iterator it = m_Entries.find( key );
+
+	if( it == m_Entries.end() )
+	{
+		m_iMisses++;
+		return NULL;
+	}
+
+	const contentEntry_t &entry = *it->second;
+
+	// handle owns it's copy, so eviction doesn't have to care about it
+	char *data = (char *)malloc( entry.size + 1 );
+
+	if( !data )
+		return NULL;
+
+	memcpy( data, entry.data, entry.size + 1 );
+
+	fs_offset_t size = entry.size;
+	searchpath_t *search = entry.search;
+	fileOrigin_t origin = entry.origin;
+
+	m_LRU.splice( m_LRU.begin(), m_LRU, it->second );
+	m_iHits++;
+	lock.unlock();
+
+	CFileHandle *handle = new CFileHandle( new CMemoryBackend( data, size ), name, options, pathID, gamedironly );
+
+	handle->SetSource( search, origin );
+
+	return handle;
+}
+
+void CContentCache::Insert( CFileHandle *handle )
+{
+	fs_offset_t size = handle->Size();
+
+	if( handle->IsWritable() || size < 0 || size > CONTENT_MAX_FILE )
+		return;
+
+	std::string key;
+
+	MakeKey( key, handle->Name(), handle->PathID(), handle->IsGameDirOnly() );
+
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+
+		if( (size_t)size > m_iBudget || m_Entries.count( key ))
+			return;
+	}
+
+	char *data = (char *)malloc( size + 1 );
+	char *copy = (char *)malloc( size + 1 );
+
+	if( !data || !copy )
+	{
+		free( data );
+		free( copy );
+		return;
+	}
+
+	// file is read just once, the handle is given the same bytes to read from memory
+	IFileBackend *backend = handle->Backend();
+	fs_offset_t orig = backend->Tell();
+
+	backend->Seek( 0, SEEK_SET );
+	fs_offset_t read = backend->Read( data, size );
+
+	if( read != size )
+	{
+		backend->Seek( orig, SEEK_SET );
+		free( data );
+		free( copy );
+		return;
+	}
+
+	data[size] = 0;
+	memcpy( copy, data, size + 1 );
+
+	contentEntry_t entry;
+
+	entry.key = key;
+	entry.data = data;
+	entry.size = size;
+	entry.search = handle->SearchPath();
+	entry.origin = handle->Origin();
+
+	handle->ReplaceBackend( new CMemoryBackend( copy, size ));
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	// someone else was reading it at the same time
+	if( m_Entries.count( key ))
+	{
+		free( data );
+		return;
+	}
+
+	Evict( size );
+
+	m_LRU.push_front( entry );
+	m_Entries[key] = m_LRU.begin();
+	m_iResident += size;
+}
+
+void CContentCache::Invalidate( const char *name )
+{
+	std::string key;
+
+	// same name under any pathID
+	MakeKey( key, name, NULL, false );
+
+	const char *fixed = key.c_str() + 2;
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	std::list<contentEntry_t>::iterator it = m_LRU.begin();
+
+	while( it != m_LRU.end() )
+	{
+		const char *entryName = strchr( it->key.c_str() + 1, ':' ) + 1;
+
+		if( !strcasecmp( entryName, fixed ))
+			Drop( it++ );
+		else ++it;
+	}
+}
+
+// in one pass, search path may have provided a lot of them
+void CContentCache::Invalidate( const std::vector<std::string> &names )
+{
+	std::unordered_set<std::string> fixed;
+	std::string key;
+
+	for( size_t i = 0; i < names.size(); i++ )
+	{
+		MakeKey( key, names[i].c_str(), NULL, false );
+		LowerCase( key );
+		fixed.insert( key.substr( 2 ));
+	}
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	std::list<contentEntry_t>::iterator it = m_LRU.begin();
+
+	while( it != m_LRU.end() )
+	{
+		std::string entryName = strchr( it->key.c_str() + 1, ':' ) + 1;
+
+		LowerCase( entryName );
+
+		if( fixed.count( entryName ))
+			Drop( it++ );
+		else ++it;
+	}
+}
+
+void CContentCache::InvalidateTree( const char *dir )
+{
+	std::string key;
+
+	MakeKey( key, dir, NULL, false );
+
+	const char *fixed = key.c_str() + 2;
+	size_t len = key.size() - 2;
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	std::list<contentEntry_t>::iterator it = m_LRU.begin();
+
+	while( it != m_LRU.end() )
+	{
+		const char *entryName = strchr( it->key.c_str() + 1, ':' ) + 1;
+
+		if( !strncasecmp( entryName, fixed, len ) && entryName[len] == '/' )
+			Drop( it++ );
+		else ++it;
+	}
+}
+
+void CContentCache::Flush()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	while( !m_LRU.empty() )
+		Drop( m_LRU.begin() );
+}
+
+void CContentCache::Evict( size_t needed )
+{
+	while( !m_LRU.empty() && m_iResident + needed > m_iBudget )
+		Drop( --m_LRU.end() );
+}
+
+void CContentCache::Drop( std::list<contentEntry_t>::iterator it )
+{
+	m_iResident -= it->size;
+	m_Entries.erase( it->key );
+	free( it->data );
+	m_LRU.erase( it );
+}
+
+size_t CContentCache::Resident()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	return m_iResident;
+}
+
+unsigned int CContentCache::Hits()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	return m_iHits;
+}
+
+unsigned int CContentCache::Misses()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	return m_iMisses;
+}
+
+void CContentCache::PrintStats()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	unsigned int total = m_iHits + m_iMisses;
+
+	engine.Msg( "FS_Stdio_Xash: content cache: %u hits, %u misses (%.1f%%), %u bytes in %u files\n",
+		m_iHits, m_iMisses, total ? m_iHits * 100.0f / total : 0.0f,
+		(unsigned int)m_iResident, (unsigned int)m_LRU.size() );
+}
@@ -0,0 +1,92 @@
+/*
+fs_content.h - in-memory cache of small read-only files
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_CONTENT_H
+#define FS_CONTENT_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <mutex>
+#include "fs_handle.h"
+
+#define CONTENT_DEFAULT_BUDGET	(4 * 1024 * 1024)
+#define CONTENT_MAX_FILE	(64 * 1024) // bigger files aren't worth keeping
+
+// budget may be overridden from environment, in bytes or with k/m suffix
+#define CONTENT_BUDGET_ENV	"FS_STDIO_CACHE_SIZE"
+
+struct contentEntry_t
+{
+	std::string key;
+	char *data;
+	fs_offset_t size;
+	searchpath_t *search;
+	fileOrigin_t origin;
+};
+
+// Bytes of small files opened with OpenFromCacheForRead. Least
+// recently used ones are dropped when budget is exceeded. One lock,
+// held only for copying and bookkeeping, never for file I/O
+class CContentCache
+{
+public:
+	CContentCache() : m_iBudget( CONTENT_DEFAULT_BUDGET ), m_iResident( 0 ), m_iHits( 0 ), m_iMisses( 0 ) { }
+	~CContentCache() { Flush(); }
+
+	void SetBudget( size_t budget );
+	void LoadBudget(); // from CONTENT_BUDGET_ENV
+
+	// handle reading from memory, NULL if file isn't cached
+	CFileHandle *Open( const char *name, const char *options, const char *pathID, bool gamedironly );
+
+	// remember contents of just opened file
+	void Insert( CFileHandle *handle );
+
+	// file was written or removed
+	void Invalidate( const char *name );
+	void Invalidate( const std::vector<std::string> &names );
+
+	// everything under directory that appeared or vanished
+	void InvalidateTree( const char *dir );
+
+	// search paths changed
+	void Flush();
+
+	size_t Resident();
+	unsigned int Hits();
+	unsigned int Misses();
+	void PrintStats();
+
+private:
+	// called with m_Mutex held
+	void Evict( size_t needed );
+	void Drop( std::list<contentEntry_t>::iterator it );
+
+	std::mutex m_Mutex;
+	size_t m_iBudget;
+	size_t m_iResident; // bytes of file data held
+
+	std::list<contentEntry_t> m_LRU; // most recently used first
+	std::unordered_map<std::string, std::list<contentEntry_t>::iterator> m_Entries;
+
+	unsigned int m_iHits;
+	unsigned int m_iMisses;
+};
+
+extern CContentCache contentCache;
+
+#endif // FS_CONTENT_H
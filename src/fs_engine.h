@@ -0,0 +1,74 @@
+/*
+fs_engine.h - xash filesystem API import and shared helpers
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_ENGINE_H
+#define FS_ENGINE_H
+
+#include <stdio.h>
+#include <time.h>
+#include "filesystem.h"
+
+typedef int qboolean;
+
+#include "fs_int.h"
+
+#define ENGINE_LIBRARY_ENV "FS_STDIO_ENGINE" // full path of library to import filesystem from instead of engine's
+
+#ifndef FS_GAMEDIRONLY_SEARCH_FLAGS
+#define FS_GAMEDIRONLY_SEARCH_FLAGS FS_GAMEDIR_PATH
+#endif
+
+// Every engine call we make is serialized, it's filesystem isn't
+// thread safe. FS_GetSearchPaths only reads the head pointer and Msg
+// is variadic, so they are left as they are
+class CEngine : public fs_api_t
+{
+public:
+	CEngine();
+	~CEngine();
+
+	// FS_GetDiskPath returns a static buffer, so it's copied before
+	// another thread may call it again
+	bool GetDiskPath( const char *name, bool gamedironly, char *out, size_t size );
+
+private:
+	void Serialize();
+
+	void *handle;
+};
+
+extern CEngine engine;
+
+inline long long Sys_MonotonicUsec( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define Mem_Free( ptr ) engine._Mem_Free( (ptr), __FILE__, __LINE__ );
+
+#ifndef NDEBUG
+#define LOGCALL( format, ... )	printf( "FS_Stdio_Xash: called %s     ->(" format ")\n" , __PRETTY_FUNCTION__, __VA_ARGS__ )
+#define LOGCALL_VOID			printf( "FS_Stdio_Xash: called %s     ->(void)\n", __PRETTY_FUNCTION__ );
+
+#define LOGRETVAL( format, ret ) printf( "FS_Stdio_Xash:             \\-> " format "\n", ret );
+#else
+#define LOGCALL( format, ... )
+#define LOGCALL_VOID
+#define LOGRETVAL( format, ret )
+#endif
+
+#endif // FS_ENGINE_H
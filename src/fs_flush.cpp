@@ -0,0 +1,133 @@
+/*
+fs_flush.cpp - background flushing of write buffers
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <vector>
+#include "fs_flush.h"
+#include "fs_handle.h"
+
+CWriteFlusher writeFlusher;
+
+void CWriteFlusher::Start()
+{
+	const char *env = getenv( WRITEBEHIND_ENV );
+
+	if( IsActive() || !env )
+		return;
+
+	int interval = atoi( env );
+
+	if( interval <= 0 )
+		return;
+
+	m_iInterval = interval;
+	m_bShutdown = false;
+	m_Thread = std::thread( &CWriteFlusher::FlusherThread, this );
+}
+
+void CWriteFlusher::Shutdown()
+{
+	if( !IsActive() )
+		return;
+
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	m_bShutdown = true;
+	m_Cond.notify_all();
+	lock.unlock();
+
+	m_Thread.join();
+
+	// handles left open are written by game thread from now on
+	lock.lock();
+
+	std::set<CFileHandle *>::iterator it;
+
+	for( it = m_Handles.begin(); it != m_Handles.end(); ++it )
+		(*it)->Drain();
+
+	m_Handles.clear();
+	m_iInterval = 0;
+}
+
+void CWriteFlusher::Register( CFileHandle *handle )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	m_Handles.insert( handle );
+}
+
+// waits if handle is being written out right now
+void CWriteFlusher::Unregister( CFileHandle *handle )
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	m_Handles.erase( handle );
+
+	while( m_pBusy == handle )
+		m_IdleCond.wait( lock );
+}
+
+void CWriteFlusher::Wake()
+{
+	if( !m_bWoken.exchange( true ))
+		m_Cond.notify_one();
+}
+
+void CWriteFlusher::FlusherThread()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	while( !m_bShutdown )
+	{
+		m_Cond.wait_for( lock, std::chrono::milliseconds( m_iInterval ));
+
+		bool woken = m_bWoken.exchange( false );
+		long long now = Sys_MonotonicUsec();
+		std::vector<CFileHandle *> due;
+		std::set<CFileHandle *>::iterator it;
+
+		for( it = m_Handles.begin(); it != m_Handles.end(); ++it )
+		{
+			CFileHandle *handle = *it;
+
+			if( !handle->PendingWrite() )
+				continue;
+
+			// full and line buffered ones right away, the rest when they are old enough
+			if(( woken && handle->DrainRequested() ) || now - handle->WriteTime() >= m_iInterval * 1000LL )
+				due.push_back( handle );
+		}
+
+		// written without m_Mutex, so opening and closing other files
+		// never waits for disk
+		for( size_t i = 0; i < due.size() && !m_bShutdown; i++ )
+		{
+			CFileHandle *handle = due[i];
+
+			// closed meanwhile
+			if( !m_Handles.count( handle ))
+				continue;
+
+			m_pBusy = handle;
+			lock.unlock();
+
+			handle->Drain();
+
+			lock.lock();
+			m_pBusy = NULL;
+			m_IdleCond.notify_all();
+		}
+	}
+}
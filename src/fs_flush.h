@@ -0,0 +1,67 @@
+/*
+fs_flush.h - background flushing of write buffers
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_FLUSH_H
+#define FS_FLUSH_H
+
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#define WRITEBEHIND_ENV "FS_STDIO_WRITEBEHIND" // flush interval in msec, unset or 0 to disable
+
+class CFileHandle;
+
+// Writes out buffers of writable handles from it's own thread, when they
+// get old or big, so game thread only copies data for small writes
+class CWriteFlusher
+{
+public:
+	CWriteFlusher() : m_pBusy( NULL ), m_iInterval( 0 ), m_bShutdown( false ), m_bWoken( false ) { }
+	~CWriteFlusher() { Shutdown(); }
+
+	// starts thread if enabled by WRITEBEHIND_ENV
+	void Start();
+
+	// write out everything and stop the thread
+	void Shutdown();
+
+	bool IsActive() const { return m_iInterval > 0; }
+	int Interval() const { return m_iInterval; }
+
+	void Register( CFileHandle *handle );
+	void Unregister( CFileHandle *handle );
+
+	// some handle has enough to write out right away
+	void Wake();
+
+private:
+	void FlusherThread();
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Cond;
+	std::condition_variable m_IdleCond; // m_pBusy is done
+	std::set<CFileHandle *> m_Handles;
+	CFileHandle *m_pBusy; // being written out, m_Mutex isn't held meanwhile
+	std::thread m_Thread;
+	int m_iInterval; // msec
+	bool m_bShutdown;
+	std::atomic<bool> m_bWoken;
+};
+
+extern CWriteFlusher writeFlusher;
+
+#endif // FS_FLUSH_H
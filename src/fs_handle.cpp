@@ -0,0 +1,551 @@
+/*
+fs_handle.cpp - FileHandle_t implementation
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "fs_handle.h"
+#include "fs_readbuf.h"
+#include "fs_flush.h"
+
+static int ParseMode( const char *options )
+{
+	int mode = 0;
+
+	for( ; options && *options; options++ )
+	{
+		switch( *options )
+		{
+		case 'r': mode |= FILE_MODE_READ; break;
+		case 'w': mode |= FILE_MODE_WRITE; break;
+		case 'a': mode |= FILE_MODE_APPEND; break;
+		case '+': mode |= FILE_MODE_UPDATE; break;
+		}
+	}
+
+	return mode;
+}
+
+CFileHandle::CFileHandle( IFileBackend *backend, const char *name, const char *options, const char *pathID, bool gamedironly )
+{
+	m_pBackend = backend;
+	m_pszName = strdup( name );
+	m_pszPathID = pathID ? strdup( pathID ) : NULL;
+	m_iMode = ParseMode( options );
+	m_bGameDirOnly = gamedironly;
+	m_bError = false;
+
+	m_iOpenTime = Sys_MonotonicUsec();
+	m_iBytesRead = 0;
+	m_iBytesWritten = 0;
+	m_iSeeks = 0;
+
+	// find out size once, everything else is tracked by us
+	m_iPosition = backend->Tell();
+
+	if( m_iMode & FILE_MODE_WRITE )
+	{
+		m_iSize = 0; // truncated
+	}
+	else
+	{
+		backend->Seek( 0, SEEK_END );
+		m_iSize = backend->Tell();
+		backend->Seek( m_iPosition, SEEK_SET );
+	}
+
+	m_bResolved = false;
+	m_iOrigin = FILE_ORIGIN_UNKNOWN;
+	m_pSearch = NULL;
+
+	m_pReadBuffers = NULL;
+
+	m_pReadAhead = NULL;
+	m_iReadAheadPos = m_iReadAheadLen = 0;
+	m_iReadAheadAlloc = 0;
+
+	m_iBufMode = _IOFBF;
+	m_iWindow = READAHEAD_SIZE;
+	m_bAdaptive = true;
+	m_bSeeked = false;
+
+	m_iWritePending = 0;
+	m_iWriteTime = 0;
+	m_bDrainRequested = false;
+	m_bFlusher = IsWritable() && writeFlusher.IsActive();
+
+	if( m_bFlusher )
+		writeFlusher.Register( this );
+}
+
+CFileHandle::~CFileHandle()
+{
+	readBufferCache.ReleaseAll( this );
+	Close();
+
+	if( m_iReadAheadAlloc )
+		free( m_pReadAhead );
+	free( m_pszPathID );
+	free( m_pszName );
+}
+
+void CFileHandle::Close()
+{
+	if( !m_pBackend )
+		return;
+
+	if( m_bFlusher )
+		writeFlusher.Unregister( this );
+
+	Drain();
+
+	delete m_pBackend;
+	m_pBackend = NULL;
+}
+
+fileOrigin_t CFileHandle::Origin()
+{
+	if( !m_bResolved )
+		Resolve();
+
+	return m_iOrigin;
+}
+
+searchpath_t *CFileHandle::SearchPath()
+{
+	if( !m_bResolved )
+		Resolve();
+
+	return m_pSearch;
+}
+
+void CFileHandle::SetSource( searchpath_t *search, fileOrigin_t origin )
+{
+	m_bResolved = true;
+	m_pSearch = search;
+	m_iOrigin = origin;
+}
+
+void CFileHandle::Resolve()
+{
+	m_bResolved = true;
+
+	if( IsWritable() )
+	{
+		// written files always land in the write directory
+		m_iOrigin = FILE_ORIGIN_LOOSE;
+		return;
+	}
+
+	m_pSearch = engine.FS_FindFile( m_pszName, NULL, m_bGameDirOnly );
+
+	if( !m_pSearch )
+		m_iOrigin = FILE_ORIGIN_UNKNOWN;
+	else if( m_pSearch->pack )
+		m_iOrigin = FILE_ORIGIN_PAK;
+	else if( m_pSearch->wad )
+		m_iOrigin = FILE_ORIGIN_WAD;
+	else m_iOrigin = FILE_ORIGIN_LOOSE;
+}
+
+bool CFileHandle::FillReadAhead()
+{
+	if( m_bAdaptive )
+	{
+		// reading on from where last block ended, take more next time
+		if( m_bSeeked )
+			m_bSeeked = false;
+		else if( m_iReadAheadLen > 0 && m_iWindow < READAHEAD_MAX )
+			m_iWindow *= 2;
+	}
+
+	if( m_iReadAheadAlloc < m_iWindow && ( m_iReadAheadAlloc || !m_pReadAhead ))
+	{
+		char *buf = (char *)realloc( m_pReadAhead, m_iWindow );
+
+		if( !buf )
+			return false;
+
+		m_pReadAhead = buf;
+		m_iReadAheadAlloc = m_iWindow;
+	}
+
+	fs_offset_t len = m_pBackend->Read( m_pReadAhead, m_iWindow );
+
+	if( len < 0 )
+		m_bError = true;
+
+	m_iReadAheadPos = 0;
+	m_iReadAheadLen = len > 0 ? len : 0;
+
+	return m_iReadAheadLen > 0;
+}
+
+void CFileHandle::ReplaceBackend( IFileBackend *backend )
+{
+	DropReadAhead();
+
+	delete m_pBackend;
+	m_pBackend = backend;
+	m_pBackend->Seek( m_iPosition, SEEK_SET );
+}
+
+void CFileHandle::DropReadAhead()
+{
+	int unread = m_iReadAheadLen - m_iReadAheadPos;
+
+	// engine is ahead of us by the bytes we haven't consumed yet
+	if( unread > 0 )
+		m_pBackend->Seek( -unread, SEEK_CUR );
+
+	m_iReadAheadPos = m_iReadAheadLen = 0;
+}
+
+int CFileHandle::Read( void *pOutput, int size )
+{
+	int n = 0;
+
+	Drain();
+
+	while( n < size )
+	{
+		int unread = m_iReadAheadLen - m_iReadAheadPos;
+
+		if( unread > 0 )
+		{
+			int len = unread < size - n ? unread : size - n;
+
+			memcpy( (char *)pOutput + n, m_pReadAhead + m_iReadAheadPos, len );
+			m_iReadAheadPos += len;
+			n += len;
+			continue;
+		}
+
+		// big reads don't need to be copied twice
+		if( m_iBufMode == _IONBF || size - n >= m_iWindow )
+		{
+			fs_offset_t rest = m_pBackend->Read( (char *)pOutput + n, size - n );
+
+			if( rest > 0 )
+				n += rest;
+			else if( rest < 0 )
+				m_bError = true;
+			break;
+		}
+
+		if( !FillReadAhead() )
+			break;
+	}
+
+	m_iPosition += n;
+	m_iBytesRead.fetch_add( n, std::memory_order_relaxed );
+	return n;
+}
+
+void CFileHandle::Written( int size, int written )
+{
+	if( written < size )
+		m_bError = true;
+
+	if( written <= 0 )
+		return;
+
+	m_iPosition += written;
+	m_iBytesWritten.fetch_add( written, std::memory_order_relaxed );
+	if( m_iPosition > m_iSize )
+		m_iSize = m_iPosition;
+}
+
+int CFileHandle::Write( const void *pInput, int size )
+{
+	if( size <= 0 )
+		return 0;
+
+	DropReadAhead();
+
+	// appends always go to the end, whatever the position was
+	if( m_iMode & FILE_MODE_APPEND )
+		m_iPosition = m_iSize;
+
+	bool newline = m_iBufMode == _IOLBF && memchr( pInput, '\n', size );
+
+	// big ones gain nothing from being copied
+	if( m_iBufMode == _IONBF || size >= WRITEBUF_SIZE )
+	{
+		Drain();
+
+		std::lock_guard<std::mutex> lock( m_IOMutex );
+		int written = m_pBackend->Write( pInput, size );
+
+		Written( size, written );
+
+		if( m_iBufMode == _IONBF || newline )
+			m_pBackend->Flush();
+
+		return written;
+	}
+
+	Buffer( pInput, size );
+	Written( size, size );
+
+	if( m_bFlusher && writeFlusher.IsActive() && PendingWrite() < WRITEBUF_MAX )
+	{
+		if( newline || PendingWrite() >= WRITEBUF_SIZE )
+		{
+			m_bDrainRequested = true;
+			writeFlusher.Wake();
+		}
+	}
+	else if( newline )
+	{
+		Flush();
+	}
+	else if( PendingWrite() >= WRITEBUF_SIZE )
+	{
+		Drain();
+	}
+
+	return size;
+}
+
+int CFileHandle::VPrintf( const char *pFormat, va_list args )
+{
+	char buf[1024];
+	char *data = buf;
+	va_list copy;
+
+	va_copy( copy, args );
+
+	int len = vsnprintf( buf, sizeof( buf ), pFormat, args );
+
+	if( len >= (int)sizeof( buf ))
+	{
+		data = (char *)malloc( len + 1 );
+
+		if( data )
+			vsnprintf( data, len + 1, pFormat, copy );
+		else len = -1;
+	}
+
+	va_end( copy );
+
+	if( len < 0 )
+	{
+		m_bError = true;
+		return -1;
+	}
+
+	int written = Write( data, len );
+
+	if( data != buf )
+		free( data );
+
+	return written;
+}
+
+void CFileHandle::Buffer( const void *data, int size )
+{
+	std::lock_guard<std::mutex> lock( m_WriteMutex );
+
+	if( m_WriteBuf.empty() )
+		m_iWriteTime = Sys_MonotonicUsec();
+
+	m_WriteBuf.insert( m_WriteBuf.end(), (const char *)data, (const char *)data + size );
+	m_iWritePending = m_WriteBuf.size();
+}
+
+// called with m_IOMutex held
+void CFileHandle::WriteOut()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_WriteMutex );
+
+		m_WriteOut.swap( m_WriteBuf );
+		m_iWritePending = 0;
+		m_bDrainRequested = false;
+	}
+
+	if( m_WriteOut.empty() )
+		return;
+
+	fs_offset_t written = m_pBackend->Write( m_WriteOut.data(), m_WriteOut.size() );
+
+	if( written < (fs_offset_t)m_WriteOut.size() )
+		m_bError = true;
+
+	// don't keep what flusher falling behind made it grow to
+	if( m_WriteOut.capacity() > WRITEBUF_SIZE * 4 )
+		std::vector<char>().swap( m_WriteOut );
+	else m_WriteOut.clear();
+}
+
+void CFileHandle::Drain()
+{
+	if( !m_pBackend )
+		return;
+
+	// flusher may be writing out right now with nothing left pending,
+	// backend mustn't be touched until it's done
+	if( !m_bFlusher && !PendingWrite() )
+		return;
+
+	std::lock_guard<std::mutex> lock( m_IOMutex );
+
+	WriteOut();
+}
+
+void CFileHandle::Flush()
+{
+	if( !m_pBackend )
+		return;
+
+	std::lock_guard<std::mutex> lock( m_IOMutex );
+
+	WriteOut();
+	m_pBackend->Flush();
+}
+
+void CFileHandle::Seek( int pos, int whence )
+{
+	int unread = m_iReadAheadLen - m_iReadAheadPos;
+
+	m_iSeeks.fetch_add( 1, std::memory_order_relaxed );
+
+	Drain();
+
+	// relative seeks inside of read-ahead don't need the engine
+	if( whence == SEEK_CUR && pos >= -m_iReadAheadPos && pos <= unread )
+	{
+		m_iReadAheadPos += pos;
+		m_iPosition += pos;
+		return;
+	}
+
+	fs_offset_t target;
+
+	switch( whence )
+	{
+	case SEEK_SET: target = pos; break;
+	case SEEK_CUR: target = m_iPosition + pos; break;
+	case SEEK_END: target = m_iSize + pos; break;
+	default: return;
+	}
+
+	DropReadAhead();
+
+	// random access, big blocks would be mostly wasted
+	if( m_bAdaptive )
+	{
+		m_bSeeked = true;
+		if( m_iWindow > READAHEAD_MIN )
+			m_iWindow /= 2;
+	}
+
+	if( m_pBackend->Seek( target, SEEK_SET ) == 0 )
+		m_iPosition = target;
+}
+
+int CFileHandle::SetVBuf( char *buffer, int mode, long size )
+{
+	if( mode != _IOFBF && mode != _IOLBF && mode != _IONBF )
+		return -1;
+
+	if( buffer && size <= 0 )
+		return -1;
+
+	// window is an int and ours is allocated, so caller can't ask for any size.
+	// Only part of caller's buffer is used then
+	if( size > READAHEAD_MAX )
+		size = READAHEAD_MAX;
+
+	// unread data would be lost with old buffer
+	Drain();
+	DropReadAhead();
+
+	if( m_iReadAheadAlloc )
+		free( m_pReadAhead );
+
+	m_pReadAhead = NULL;
+	m_iReadAheadAlloc = 0;
+	m_iBufMode = mode;
+	m_bSeeked = false;
+
+	if( buffer )
+	{
+		m_pReadAhead = buffer;
+		m_iWindow = (int)size;
+		m_bAdaptive = false;
+	}
+	else if( size > 0 )
+	{
+		m_iWindow = (int)size;
+		m_bAdaptive = false;
+	}
+	else
+	{
+		m_iWindow = READAHEAD_SIZE;
+		m_bAdaptive = true;
+	}
+
+	return 0;
+}
+
+char *CFileHandle::ReadLine( char *pOutput, int maxChars )
+{
+	if( maxChars <= 0 )
+		return NULL;
+
+	Drain();
+
+	if( m_iReadAheadPos >= m_iReadAheadLen && !FillReadAhead() )
+		return NULL;
+
+	int len = 0;
+
+	// pull whole blocks and look for the line end in them, instead of
+	// going to the engine for every character
+	while( len < maxChars - 1 )
+	{
+		if( m_iReadAheadPos >= m_iReadAheadLen && !FillReadAhead() )
+			break;
+
+		const char *start = m_pReadAhead + m_iReadAheadPos;
+		int avail = m_iReadAheadLen - m_iReadAheadPos;
+
+		if( avail > maxChars - 1 - len )
+			avail = maxChars - 1 - len;
+
+		const char *end = (const char *)memchr( start, '\n', avail );
+		int n = end ? end - start : avail;
+
+		memcpy( pOutput + len, start, n );
+		len += n;
+		m_iReadAheadPos += n;
+		m_iPosition += n;
+		m_iBytesRead.fetch_add( n, std::memory_order_relaxed );
+
+		if( end )
+		{
+			m_iReadAheadPos++; // eat newline
+			m_iPosition++;
+			m_iBytesRead.fetch_add( 1, std::memory_order_relaxed );
+			break;
+		}
+	}
+
+	if( len > 0 && pOutput[len-1] == '\r' )
+		len--;
+
+	pOutput[len] = 0;
+	return pOutput;
+}
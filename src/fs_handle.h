@@ -0,0 +1,175 @@
+/*
+fs_handle.h - FileHandle_t implementation
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_HANDLE_H
+#define FS_HANDLE_H
+
+#include <stdarg.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "fs_engine.h"
+#include "fs_backend.h"
+
+// adaptive read-ahead window, starts at READAHEAD_SIZE
+#define READAHEAD_MIN	4096
+#define READAHEAD_SIZE	16384
+#define READAHEAD_MAX	(256 * 1024)
+
+// small writes are collected, written out when buffer reaches WRITEBUF_SIZE,
+// or by the flusher thread, unless it fell behind by WRITEBUF_MAX
+#define WRITEBUF_SIZE	16384
+#define WRITEBUF_MAX	(1024 * 1024)
+
+enum fileOrigin_t
+{
+	FILE_ORIGIN_UNKNOWN = 0,
+	FILE_ORIGIN_LOOSE,
+	FILE_ORIGIN_PAK,
+	FILE_ORIGIN_WAD
+};
+
+// open mode flags
+#define FILE_MODE_READ		(1<<0)
+#define FILE_MODE_WRITE		(1<<1)
+#define FILE_MODE_APPEND	(1<<2)
+#define FILE_MODE_UPDATE	(1<<3) // '+'
+
+struct readBuffer_t;
+
+// FileHandle_t points to this, engine's file_t is wrapped
+class CFileHandle
+{
+public:
+	CFileHandle( IFileBackend *backend, const char *name, const char *options, const char *pathID, bool gamedironly );
+	~CFileHandle();
+
+	// close underlying file now, handle itself may live a bit longer
+	void Close();
+
+	IFileBackend *Backend() const { return m_pBackend; }
+	file_t *Native() const { return m_pBackend ? m_pBackend->Native() : NULL; }
+	const char *Name() const { return m_pszName; }
+	const char *PathID() const { return m_pszPathID; }
+	int Mode() const { return m_iMode; }
+	bool IsGameDirOnly() const { return m_bGameDirOnly; }
+	bool IsWritable() const { return m_iMode & ( FILE_MODE_WRITE|FILE_MODE_APPEND|FILE_MODE_UPDATE ); }
+
+	// cached at open and updated by writes, no engine calls
+	fs_offset_t Size() const { return m_iSize; }
+	fs_offset_t Tell() const { return m_iPosition; }
+	bool Eof() const { return m_iPosition >= m_iSize; }
+	bool IsOk() const { return !m_bError.load( std::memory_order_relaxed ); }
+
+	// usage statistics, updated without locks
+	long long OpenTime() const { return m_iOpenTime; }
+	fs_offset_t BytesRead() const { return m_iBytesRead.load( std::memory_order_relaxed ); }
+	fs_offset_t BytesWritten() const { return m_iBytesWritten.load( std::memory_order_relaxed ); }
+	int Seeks() const { return m_iSeeks.load( std::memory_order_relaxed ); }
+
+	// bytes taken some other way than Read, like GetReadBuffer
+	void AddBytesRead( fs_offset_t n ) { m_iBytesRead.fetch_add( n, std::memory_order_relaxed ); }
+
+	// find out where the file came from, resolved once
+	fileOrigin_t Origin();
+	searchpath_t *SearchPath();
+	void SetSource( searchpath_t *search, fileOrigin_t origin );
+
+	// read only file is held in memory now, old backend is closed
+	void ReplaceBackend( IFileBackend *backend );
+
+	// I/O, engine file position is kept in sync with read-ahead and write buffers
+	int Read( void *pOutput, int size );
+	int Write( const void *pInput, int size );
+	int VPrintf( const char *pFormat, va_list args );
+	void Seek( int pos, int whence );
+	char *ReadLine( char *pOutput, int maxChars );
+
+	// setvbuf semantics, no size and buffer keeps adaptive window
+	int SetVBuf( char *buffer, int mode, long size );
+
+	// write out buffered data, Flush also asks backend to flush
+	void Drain();
+	void Flush();
+
+	// for the flusher thread
+	int PendingWrite() const { return m_iWritePending.load( std::memory_order_relaxed ); }
+	long long WriteTime() const { return m_iWriteTime.load( std::memory_order_relaxed ); }
+	bool DrainRequested() const { return m_bDrainRequested.load( std::memory_order_relaxed ); }
+
+	// outstanding GetReadBuffer results, see fs_readbuf.cpp
+	readBuffer_t *m_pReadBuffers;
+
+private:
+	void Resolve();
+
+	bool FillReadAhead();
+	void DropReadAhead();
+	void Written( int size, int written );
+	void Buffer( const void *data, int size );
+	void WriteOut();
+
+	IFileBackend *m_pBackend;
+	char *m_pszName;
+	char *m_pszPathID;
+	int m_iMode;
+	bool m_bGameDirOnly;
+
+	fs_offset_t m_iSize;
+	fs_offset_t m_iPosition;
+	std::atomic<bool> m_bError;
+
+	long long m_iOpenTime; // monotonic usec
+	std::atomic<fs_offset_t> m_iBytesRead;
+	std::atomic<fs_offset_t> m_iBytesWritten;
+	std::atomic<int> m_iSeeks;
+
+	bool m_bResolved;
+	fileOrigin_t m_iOrigin;
+	searchpath_t *m_pSearch;
+
+	char *m_pReadAhead;
+	int m_iReadAheadPos;
+	int m_iReadAheadLen;
+	int m_iReadAheadAlloc; // 0 if buffer isn't ours
+
+	int m_iBufMode; // _IOFBF, _IOLBF or _IONBF
+	int m_iWindow; // bytes to read at once
+	bool m_bAdaptive;
+	bool m_bSeeked; // since last fill
+
+	// game thread appends to m_WriteBuf, whoever drains swaps it with
+	// m_WriteOut and writes that with m_IOMutex held, so game thread only
+	// waits for disk when it touches the backend itself
+	std::vector<char> m_WriteBuf; // m_WriteMutex
+	std::vector<char> m_WriteOut; // m_IOMutex
+	std::mutex m_WriteMutex;
+	std::mutex m_IOMutex;
+	std::atomic<int> m_iWritePending;
+	std::atomic<long long> m_iWriteTime; // monotonic usec of oldest buffered byte
+	std::atomic<bool> m_bDrainRequested;
+	bool m_bFlusher; // registered with writeFlusher
+};
+
+inline CFileHandle *FileHandle( FileHandle_t file )
+{
+	return (CFileHandle *)file;
+}
+
+inline file_t *NativeFile( FileHandle_t file )
+{
+	return file ? FileHandle( file )->Native() : NULL;
+}
+
+#endif // FS_HANDLE_H
@@ -0,0 +1,1151 @@
+/*
+fs_index.cpp - in-memory index of all files in search paths
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "fs_index.h"
+#include "fs_pack.h"
+#include "fs_metrics.h"
+#include "fs_watch.h"
+
+#define MAX_INDEX_DEPTH 16
+
+CSearchIndex searchIndex;
+std::mutex searchPathLock;
+
+// extensions engine may look up in wad files, these can't be answered
+// if there is a wad in front of indexed file
+static const char *wadExtensions[] =
+{
+	"pal", "lmp", "fnt", "mip", "dds", "txt", "lst", NULL
+};
+
+static bool IsWadExtension( const std::string &name )
+{
+	size_t dot = name.rfind( '.' );
+
+	if( dot == std::string::npos || name.find( '/', dot ) != std::string::npos )
+		return false;
+
+	for( int i = 0; wadExtensions[i]; i++ )
+	{
+		if( !strcasecmp( name.c_str() + dot + 1, wadExtensions[i] ))
+			return true;
+	}
+
+	return false;
+}
+
+// forward slashes, no duplicate or leading ones
+static void FixName( std::string &out, const char *name )
+{
+	out.clear();
+
+	if( name[0] == '.' && ( name[1] == '/' || name[1] == '\\' ))
+		name += 2;
+
+	for( ; *name; name++ )
+	{
+		char c = *name == '\\' ? '/' : *name;
+
+		if( c == '/' && ( out.empty() || out[out.size() - 1] == '/' ))
+			continue;
+
+		out += c;
+	}
+}
+
+static void MakeKey( std::string &key, const std::string &name )
+{
+	key = name;
+
+	for( size_t i = 0; i < key.size(); i++ )
+		key[i] = tolower( key[i] );
+}
+
+static std::string ParentDir( const std::string &key )
+{
+	size_t slash = key.rfind( '/' );
+
+	return slash == std::string::npos ? std::string() : key.substr( 0, slash );
+}
+
+// '*' and '?' never match path separator
+bool MatchPattern( const char *str, const char *pattern )
+{
+	for( ; *pattern; pattern++, str++ )
+	{
+		if( *pattern == '*' )
+		{
+			pattern++;
+
+			for( ;; str++ )
+			{
+				if( MatchPattern( str, pattern ))
+					return true;
+
+				if( !*str || *str == '/' )
+					return false;
+			}
+		}
+
+		if( *pattern == '?' )
+		{
+			if( !*str || *str == '/' )
+				return false;
+		}
+		else if( tolower( *pattern ) != tolower( *str ))
+			return false;
+	}
+
+	return !*str;
+}
+
+// stat results are written in place, so shards are never copied while it's done
+static std::mutex statLocks[LOCK_SHARDS];
+
+static size_t IndexShard( const std::string &key )
+{
+	return std::hash<std::string>()( key ) % INDEX_SHARDS;
+}
+
+CSearchSnapshot::CSearchSnapshot() : m_bActive( false ), m_iGeneration( 0 ), m_pHead( NULL ), m_iTopRank( 0 )
+{
+	m_iWadRank[0] = m_iWadRank[1] = 0;
+
+	for( int i = 0; i < INDEX_SHARDS; i++ )
+	{
+		m_Files[i] = std::make_shared<indexFiles_t>();
+		m_Dirs[i] = std::make_shared<indexDirs_t>();
+	}
+}
+
+indexEntry_t *CSearchSnapshot::Entry( const std::string &key )
+{
+	indexFiles_t &files = *m_Files[IndexShard( key )];
+	indexFiles_t::iterator it = files.find( key );
+
+	return it == files.end() ? NULL : &it->second;
+}
+
+const indexEntry_t *CSearchSnapshot::Entry( const std::string &key ) const
+{
+	const indexFiles_t &files = *m_Files[IndexShard( key )];
+	indexFiles_t::const_iterator it = files.find( key );
+
+	return it == files.end() ? NULL : &it->second;
+}
+
+const std::set<std::string> *CSearchSnapshot::Children( const std::string &dir ) const
+{
+	const indexDirs_t &dirs = *m_Dirs[IndexShard( dir )];
+	indexDirs_t::const_iterator it = dirs.find( dir );
+
+	return it == dirs.end() ? NULL : &it->second;
+}
+
+indexFiles_t &CSearchSnapshot::EditFiles( const std::string &key )
+{
+	std::shared_ptr<indexFiles_t> &shard = m_Files[IndexShard( key )];
+
+	// only this unpublished copy has it otherwise
+	if( shard.use_count() > 1 )
+	{
+		std::unique_lock<std::mutex> locks[LOCK_SHARDS];
+
+		for( int i = 0; i < LOCK_SHARDS; i++ )
+			locks[i] = std::unique_lock<std::mutex>( statLocks[i] );
+
+		shard = std::make_shared<indexFiles_t>( *shard );
+	}
+
+	return *shard;
+}
+
+indexDirs_t &CSearchSnapshot::EditDirs( const std::string &dir )
+{
+	std::shared_ptr<indexDirs_t> &shard = m_Dirs[IndexShard( dir )];
+
+	if( shard.use_count() > 1 )
+		shard = std::make_shared<indexDirs_t>( *shard );
+
+	return *shard;
+}
+
+void CSearchSnapshot::Build( const std::unordered_set<searchpath_t *> &removed )
+{
+	// removed paths stay hidden
+	m_Removed = removed;
+	m_pHead = engine.FS_GetSearchPaths();
+
+	for( searchpath_t *search = m_pHead; search; search = search->next )
+	{
+		if( !IsRemoved( search ))
+			m_Paths.push_back( search );
+	}
+
+	for( size_t i = 0; i < m_Paths.size(); i++ )
+	{
+		m_Ranks.push_back( m_Paths.size() - i );
+		m_Masks.push_back( pathIDs.Mask( m_Paths[i] ));
+	}
+
+	AddSearchPaths( m_Paths, m_Ranks );
+
+	m_bActive = true;
+}
+
+// false if it must be built again
+bool CSearchSnapshot::Sync( searchpath_t *head )
+{
+	// engine prepends new search paths, so old list must be the tail of new one
+	std::vector<searchpath_t *> fresh;
+	std::vector<int> ranks;
+	std::vector<pathIDMask_t> masks;
+	searchpath_t *search = head;
+
+	for( ; search && search != m_pHead; search = search->next )
+	{
+		if( !IsRemoved( search ))
+			fresh.push_back( search );
+	}
+
+	size_t i = 0;
+	for( ; search; search = search->next )
+	{
+		if( IsRemoved( search ))
+			continue;
+
+		if( i >= m_Paths.size() || m_Paths[i] != search )
+			break;
+		i++;
+	}
+
+	// something was removed or reordered behind our back
+	if( search || i != m_Paths.size() )
+		return false;
+
+	for( i = 0; i < fresh.size(); i++ )
+	{
+		ranks.push_back( m_iTopRank + fresh.size() - i );
+		masks.push_back( pathIDs.Mask( fresh[i] ));
+	}
+
+	AddSearchPaths( fresh, ranks );
+
+	m_Paths.insert( m_Paths.begin(), fresh.begin(), fresh.end() );
+	m_Ranks.insert( m_Ranks.begin(), ranks.begin(), ranks.end() );
+	m_Masks.insert( m_Masks.begin(), masks.begin(), masks.end() );
+	m_pHead = head;
+	return true;
+}
+
+void CSearchSnapshot::AddSearchPaths( const std::vector<searchpath_t *> &paths, const std::vector<int> &ranks )
+{
+	indexFiles_t added;
+	int count = paths.size();
+
+	for( int i = 0; i < count; i++ )
+	{
+		searchpath_t *search = paths[i];
+		int rank = ranks[i];
+
+		m_HitCounters[search] = metrics.SearchPathCounter( search );
+
+		if( search->pack )
+		{
+			AddPackFile( search, rank, added );
+		}
+		else if( search->wad )
+		{
+			if( rank > m_iWadRank[0] )
+				m_iWadRank[0] = rank;
+
+			if( ( search->flags & FS_GAMEDIRONLY_SEARCH_FLAGS ) && rank > m_iWadRank[1] )
+				m_iWadRank[1] = rank;
+		}
+		else
+		{
+			AddLooseDirectory( search, rank, std::string(), 0, added );
+		}
+
+		if( rank > m_iTopRank )
+			m_iTopRank = rank;
+	}
+
+	Merge( added );
+}
+
+void CSearchSnapshot::AddEntry( indexFiles_t &added, const std::string &name, bool isDir, searchpath_t *search, int rank, fileOrigin_t origin )
+{
+	std::string key;
+
+	MakeKey( key, name );
+
+	std::unordered_map<std::string, indexEntry_t>::iterator it = added.find( key );
+
+	if( it == added.end() )
+	{
+		indexEntry_t entry;
+
+		entry.name = name;
+		entry.isDir = isDir;
+		memset( entry.source, 0, sizeof( entry.source ));
+
+		it = added.insert( std::make_pair( key, entry )).first;
+	}
+
+	// paths come in engine order, so first one to provide the file wins
+	for( int which = 0; which < 2; which++ )
+	{
+		indexSource_t &source = it->second.source[which];
+
+		if( which == 1 && !( search->flags & FS_GAMEDIRONLY_SEARCH_FLAGS ))
+			continue;
+
+		if( source.search )
+			continue;
+
+		source.search = search;
+		source.rank = rank;
+		source.origin = origin;
+		source.haveStat = false;
+	}
+}
+
+void CSearchSnapshot::AddLooseDirectory( searchpath_t *search, int rank, const std::string &dir, int depth, indexFiles_t &added )
+{
+	char path[MAX_SYSPATH];
+	size_t len = strlen( search->filename );
+	bool slash = len && search->filename[len - 1] != '/';
+
+	snprintf( path, sizeof( path ), "%s%s%s", search->filename, slash ? "/" : "", dir.c_str() );
+
+	DIR *d = opendir( path[0] ? path : "." );
+
+	if( !d )
+		return;
+
+	struct dirent *ent;
+
+	while(( ent = readdir( d )))
+	{
+		if( ent->d_name[0] == '.' && ( !ent->d_name[1] || ( ent->d_name[1] == '.' && !ent->d_name[2] )))
+			continue;
+
+		std::string name = dir.empty() ? std::string( ent->d_name ) : dir + "/" + ent->d_name;
+		bool isDir = ent->d_type == DT_DIR;
+
+		if( ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK )
+		{
+			std::string full = std::string( path ) + ( path[0] && !dir.empty() ? "/" : "" ) + ent->d_name;
+			struct stat st;
+
+			if( stat( full.c_str(), &st ) < 0 )
+				continue;
+
+			isDir = S_ISDIR( st.st_mode );
+		}
+
+		AddEntry( added, name, isDir, search, rank, FILE_ORIGIN_LOOSE );
+
+		if( isDir && depth < MAX_INDEX_DEPTH )
+			AddLooseDirectory( search, rank, name, depth + 1, added );
+	}
+
+	closedir( d );
+}
+
+void CSearchSnapshot::AddPackFile( searchpath_t *search, int rank, indexFiles_t &added )
+{
+	CPackFile *pack = Pack_ForSearchPath( search );
+
+	if( !pack )
+		return;
+
+	const std::vector<packEntry_t> &entries = pack->Entries();
+
+	for( size_t i = 0; i < entries.size(); i++ )
+	{
+		const std::string &name = entries[i].name;
+
+		// directories are implied by entry names
+		for( size_t slash = name.find( '/' ); slash != std::string::npos; slash = name.find( '/', slash + 1 ))
+			AddEntry( added, name.substr( 0, slash ), true, search, rank, FILE_ORIGIN_PAK );
+
+		AddEntry( added, name, false, search, rank, FILE_ORIGIN_PAK );
+	}
+}
+
+void CSearchSnapshot::Merge( indexFiles_t &added )
+{
+	indexFiles_t::iterator it;
+
+	for( it = added.begin(); it != added.end(); ++it )
+	{
+		indexFiles_t &files = EditFiles( it->first );
+		indexFiles_t::iterator existing = files.find( it->first );
+
+		if( existing == files.end() )
+		{
+			files.insert( *it );
+
+			std::string dir = ParentDir( it->first );
+			EditDirs( dir )[dir].insert( it->first );
+			continue;
+		}
+
+		indexEntry_t &entry = existing->second;
+		bool replaced = false;
+
+		// higher ranked path wins
+		for( int which = 0; which < 2; which++ )
+		{
+			const indexSource_t &source = it->second.source[which];
+
+			if( source.search && ( !entry.source[which].search || source.rank > entry.source[which].rank ))
+			{
+				entry.source[which] = source;
+				replaced |= which == 0;
+			}
+		}
+
+		if( replaced )
+		{
+			entry.name = it->second.name;
+			entry.isDir = it->second.isDir;
+		}
+	}
+}
+
+bool CSearchSnapshot::Trusted( const indexEntry_t &entry, int which ) const
+{
+	if( entry.source[which].rank < m_iWadRank[which] && IsWadExtension( entry.name ))
+		return false;
+
+	return true;
+}
+
+indexSource_t *CSearchSnapshot::Find( const char *name, bool gamedironly )
+{
+	indexSource_t *source = Lookup( name, gamedironly );
+
+	if( source )
+		CountHit( source->search );
+	else metrics.Add( METRIC_LOOKUP_MISSES, 1 );
+
+	return source;
+}
+
+void CSearchSnapshot::CountHit( searchpath_t *search ) const
+{
+	std::unordered_map<searchpath_t *, CMetricCounter *>::const_iterator it = m_HitCounters.find( search );
+
+	if( it != m_HitCounters.end() )
+		it->second->Add( 1 );
+}
+
+indexSource_t *CSearchSnapshot::Lookup( const char *name, bool gamedironly )
+{
+	if( !m_bActive )
+		return NULL;
+
+	std::string fixed, key;
+
+	FixName( fixed, name );
+	MakeKey( key, fixed );
+
+	indexEntry_t *entry = Entry( key );
+
+	if( !entry )
+		return NULL;
+
+	int which = gamedironly ? 1 : 0;
+
+	if( entry->isDir || !entry->source[which].search || !Trusted( *entry, which ))
+		return NULL;
+
+	// loose files are case sensitive, engine would look further
+	if( entry->source[which].origin == FILE_ORIGIN_LOOSE && entry->name != fixed )
+		return NULL;
+
+	return &entry->source[which];
+}
+
+indexSource_t *CSearchSnapshot::FindIn( const char *name, pathIDMask_t scope, indexSource_t *scratch )
+{
+	indexSource_t *source = Lookup( name, false );
+
+	// first of all search paths is the first of scoped ones too
+	if( source && InScope( source->search, scope ))
+	{
+		CountHit( source->search );
+		return source;
+	}
+
+	std::string fixed;
+	int found = -1;
+
+	if( m_bActive )
+	{
+		FixName( fixed, name );
+		found = Locate( fixed, false, 0, scope );
+	}
+
+	if( found < 0 )
+	{
+		metrics.Add( METRIC_LOOKUP_MISSES, 1 );
+		return NULL;
+	}
+
+	CountHit( m_Paths[found] );
+	scratch->search = m_Paths[found];
+	scratch->rank = m_Ranks[found];
+	scratch->origin = m_Paths[found]->pack ? FILE_ORIGIN_PAK : FILE_ORIGIN_LOOSE;
+	scratch->haveStat = false;
+
+	return scratch;
+}
+
+bool CSearchSnapshot::Stat( indexSource_t *source, const char *name )
+{
+	std::lock_guard<std::mutex> lock( statLocks[LockShard( (size_t)source / sizeof( *source ))] );
+
+	if( source->haveStat )
+		return true;
+
+	if( source->origin == FILE_ORIGIN_PAK )
+	{
+		CPackFile *pack = Pack_ForSearchPath( source->search );
+		const packEntry_t *entry = pack ? pack->FindEntry( name ) : NULL;
+
+		if( !entry )
+			return false;
+
+		source->size = entry->size;
+		source->time = pack->FileTime();
+	}
+	else
+	{
+		char path[MAX_SYSPATH];
+		struct stat st;
+
+		if( !DiskPath( source, name, path, sizeof( path )) || stat( path, &st ) < 0 )
+			return false;
+
+		source->size = st.st_size;
+		source->time = st.st_mtime;
+	}
+
+	source->haveStat = true;
+	return true;
+}
+
+bool CSearchSnapshot::DiskPath( const indexSource_t *source, const char *name, char *out, size_t size )
+{
+	if( source->origin != FILE_ORIGIN_LOOSE )
+		return false;
+
+	std::string fixed;
+	const char *filename = source->search->filename;
+	size_t len = strlen( filename );
+
+	FixName( fixed, name );
+
+	return snprintf( out, size, "%s%s%s", filename, len && filename[len - 1] != '/' ? "/" : "", fixed.c_str() ) < (int)size;
+}
+
+void CSearchSnapshot::Update( const char *name )
+{
+	std::string fixed, key;
+
+	FixName( fixed, name );
+	MakeKey( key, fixed );
+
+	indexFiles_t added;
+
+	for( int which = 0; which < 2; which++ )
+	{
+		size_t i;
+
+		if( HasRemoved() )
+		{
+			// engine would answer with removed paths too
+			int found = Locate( fixed, false, which );
+
+			i = found < 0 ? m_Paths.size() : found;
+		}
+		else
+		{
+			searchpath_t *found = engine.FS_FindFile( fixed.c_str(), NULL, which == 1 );
+
+			for( i = 0; i < m_Paths.size() && m_Paths[i] != found; i++ );
+		}
+
+		if( i == m_Paths.size() || m_Paths[i]->wad )
+			continue;
+
+		searchpath_t *search = m_Paths[i];
+		int rank = m_Ranks[i];
+
+		std::string dir = ParentDir( fixed );
+		fileOrigin_t origin = search->pack ? FILE_ORIGIN_PAK : FILE_ORIGIN_LOOSE;
+
+		for( size_t slash = dir.find( '/' ); slash != std::string::npos; slash = dir.find( '/', slash + 1 ))
+			AddEntry( added, dir.substr( 0, slash ), true, search, rank, origin );
+
+		if( !dir.empty() )
+			AddEntry( added, dir, true, search, rank, origin );
+
+		AddEntry( added, fixed, false, search, rank, origin );
+	}
+
+	// forget old sources of this file, whatever engine says now is the truth
+	const indexEntry_t *old = Entry( key );
+
+	if( old && !old->isDir )
+	{
+		std::string dir = ParentDir( key );
+
+		EditDirs( dir )[dir].erase( key );
+		EditFiles( key ).erase( key );
+	}
+
+	for( indexFiles_t::iterator it = added.begin(); it != added.end(); ++it )
+	{
+		// keep sources of existing parent directories
+		if( it->first != key && Entry( it->first ))
+			continue;
+
+		std::string dir = ParentDir( it->first );
+
+		EditFiles( it->first ).insert( *it );
+		EditDirs( dir )[dir].insert( it->first );
+	}
+}
+
+// what search has under dir is read from disk again, rest of search
+// paths are asked only for what it doesn't have anymore
+// published snapshot is left as it is, stat results are changed in place like Stat does
+bool CSearchSnapshot::Restat( const char *name )
+{
+	std::string fixed, key;
+
+	FixName( fixed, name );
+	MakeKey( key, fixed );
+
+	indexEntry_t *entry = Entry( key );
+	size_t i;
+
+	// write path is the first of loose ones
+	for( i = 0; i < m_Paths.size() && ( m_Paths[i]->pack || m_Paths[i]->wad || ( m_Paths[i]->flags & FS_NOWRITE_PATH )); i++ );
+
+	if( !entry || entry->isDir || i == m_Paths.size() )
+		return false;
+
+	searchpath_t *write = m_Paths[i];
+
+	for( int which = 0; which < 2; which++ )
+	{
+		if( which == 1 && !( write->flags & FS_GAMEDIRONLY_SEARCH_FLAGS ))
+			continue;
+
+		if( entry->source[which].search != write || entry->source[which].origin != FILE_ORIGIN_LOOSE )
+			return false;
+	}
+
+	for( int which = 0; which < 2; which++ )
+	{
+		indexSource_t *source = &entry->source[which];
+
+		if( source->search != write )
+			continue;
+
+		{
+			std::lock_guard<std::mutex> lock( statLocks[LockShard( (size_t)source / sizeof( *source ))] );
+
+			source->haveStat = false;
+		}
+
+		Stat( source, fixed.c_str() );
+	}
+
+	return true;
+}
+
+void CSearchSnapshot::UpdateTree( searchpath_t *search, const char *dir )
+{
+	size_t i;
+
+	for( i = 0; i < m_Paths.size() && m_Paths[i] != search; i++ );
+
+	if( i == m_Paths.size() || search->pack || search->wad )
+		return;
+
+	std::string fixed, key;
+	indexFiles_t present;
+	indexSource_t source;
+	char path[MAX_SYSPATH];
+	struct stat st;
+
+	FixName( fixed, dir );
+	MakeKey( key, fixed );
+
+	if( key.empty() )
+		return;
+
+	source.search = search;
+	source.origin = FILE_ORIGIN_LOOSE;
+
+	if( DiskPath( &source, fixed.c_str(), path, sizeof( path )) && stat( path, &st ) == 0 && S_ISDIR( st.st_mode ))
+	{
+		int depth = std::count( fixed.begin(), fixed.end(), '/' ) + 1;
+
+		AddEntry( present, fixed, true, search, m_Ranks[i], FILE_ORIGIN_LOOSE );
+
+		if( depth <= MAX_INDEX_DEPTH )
+			AddLooseDirectory( search, m_Ranks[i], fixed, depth, present );
+	}
+
+	std::vector<std::string> subtree, gone;
+
+	Subtree( key, subtree );
+
+	for( size_t j = 0; j < subtree.size(); j++ )
+	{
+		if( !present.count( subtree[j] ))
+			gone.push_back( subtree[j] );
+	}
+
+	Reresolve( search, gone, NULL );
+	Merge( present );
+}
+
+// indexed directory and everything under it, parents first
+void CSearchSnapshot::Subtree( const std::string &key, std::vector<std::string> &out ) const
+{
+	if( !Entry( key ))
+		return;
+
+	out.push_back( key );
+
+	const std::set<std::string> *children = Children( key );
+
+	if( !children )
+		return;
+
+	for( std::set<std::string>::const_iterator it = children->begin(); it != children->end(); ++it )
+		Subtree( *it, out );
+}
+
+// sources that were search are looked up again in the rest of search
+// paths, entries nobody has anymore are gone
+void CSearchSnapshot::Reresolve( searchpath_t *search, const std::vector<std::string> &keys, std::vector<std::string> *changed )
+{
+	for( size_t i = 0; i < keys.size(); i++ )
+	{
+		const std::string &key = keys[i];
+		const indexEntry_t *old = Entry( key );
+
+		if( !old || ( old->source[0].search != search && old->source[1].search != search ))
+			continue;
+
+		indexFiles_t &files = EditFiles( key );
+		indexEntry_t &entry = files[key];
+
+		if( changed )
+			changed->push_back( entry.name );
+
+		for( int which = 0; which < 2; which++ )
+		{
+			indexSource_t &source = entry.source[which];
+
+			if( source.search != search )
+				continue;
+
+			int found = Locate( entry.name, entry.isDir, which );
+
+			memset( &source, 0, sizeof( source ));
+
+			if( found < 0 )
+				continue;
+
+			source.search = m_Paths[found];
+			source.rank = m_Ranks[found];
+			source.origin = m_Paths[found]->pack ? FILE_ORIGIN_PAK : FILE_ORIGIN_LOOSE;
+		}
+
+		// gamedir paths are a subset of all paths
+		if( !entry.source[0].search )
+		{
+			std::string dir = ParentDir( key );
+
+			if( entry.isDir )
+				EditDirs( key ).erase( key );
+
+			// parent may be gone already
+			indexDirs_t &dirs = EditDirs( dir );
+			indexDirs_t::iterator parent = dirs.find( dir );
+
+			if( parent != dirs.end() )
+				parent->second.erase( key );
+
+			files.erase( key );
+		}
+	}
+}
+
+// first of search paths to have the file, -1 if none
+int CSearchSnapshot::Locate( const std::string &name, bool isDir, int which, pathIDMask_t scope ) const
+{
+	for( size_t i = 0; i < m_Paths.size(); i++ )
+	{
+		searchpath_t *search = m_Paths[i];
+
+		if( which == 1 && !( search->flags & FS_GAMEDIRONLY_SEARCH_FLAGS ))
+			continue;
+
+		if( scope && !( m_Masks[i] & scope ))
+			continue;
+
+		if( search->pack )
+		{
+			CPackFile *pack = Pack_ForSearchPath( search );
+
+			if( pack && ( isDir ? pack->HasDirectory( name.c_str() ) : pack->FindEntry( name.c_str() ) != NULL ))
+				return i;
+		}
+		else if( !search->wad )
+		{
+			indexSource_t source;
+			char path[MAX_SYSPATH];
+			struct stat st;
+
+			source.search = search;
+			source.origin = FILE_ORIGIN_LOOSE;
+
+			if( DiskPath( &source, name.c_str(), path, sizeof( path )) && stat( path, &st ) == 0 && S_ISDIR( st.st_mode ) == isDir )
+				return i;
+		}
+	}
+
+	return -1;
+}
+
+bool CSearchSnapshot::InScope( const searchpath_t *search, pathIDMask_t scope ) const
+{
+	for( size_t i = 0; i < m_Paths.size(); i++ )
+	{
+		if( m_Paths[i] == search )
+			return ( m_Masks[i] & scope ) != 0;
+	}
+
+	return false;
+}
+
+bool CSearchSnapshot::HasIn( const char *name, pathIDMask_t scope ) const
+{
+	if( !m_bActive )
+		return false;
+
+	std::string fixed;
+
+	FixName( fixed, name );
+
+	return Locate( fixed, false, 0, scope ) >= 0 || Locate( fixed, true, 0, scope ) >= 0;
+}
+
+void CSearchSnapshot::UpdateWadRanks()
+{
+	m_iWadRank[0] = m_iWadRank[1] = 0;
+
+	for( size_t i = 0; i < m_Paths.size(); i++ )
+	{
+		if( !m_Paths[i]->wad )
+			continue;
+
+		if( m_Ranks[i] > m_iWadRank[0] )
+			m_iWadRank[0] = m_Ranks[i];
+
+		if(( m_Paths[i]->flags & FS_GAMEDIRONLY_SEARCH_FLAGS ) && m_Ranks[i] > m_iWadRank[1] )
+			m_iWadRank[1] = m_Ranks[i];
+	}
+}
+
+bool CSearchSnapshot::Remove( searchpath_t *search, std::vector<std::string> &changed )
+{
+	size_t i;
+
+	for( i = 0; i < m_Paths.size() && m_Paths[i] != search; i++ );
+
+	if( i == m_Paths.size() )
+		return false;
+
+	int rank = m_Ranks[i];
+
+	m_Paths.erase( m_Paths.begin() + i );
+	m_Ranks.erase( m_Ranks.begin() + i );
+	m_Masks.erase( m_Masks.begin() + i );
+	m_HitCounters.erase( search );
+	m_Removed.insert( search );
+
+	if( search->wad )
+	{
+		UpdateWadRanks();
+		return true;
+	}
+
+	// only what this path has can change
+	indexFiles_t provided;
+
+	if( search->pack )
+		AddPackFile( search, rank, provided );
+	else AddLooseDirectory( search, rank, std::string(), 0, provided );
+
+	std::vector<std::string> keys;
+
+	for( indexFiles_t::iterator it = provided.begin(); it != provided.end(); ++it )
+		keys.push_back( it->first );
+
+	Reresolve( search, keys, &changed );
+	return true;
+}
+
+void CSearchSnapshot::RemoveAll()
+{
+	m_Removed.insert( m_Paths.begin(), m_Paths.end() );
+	m_Paths.clear();
+	m_Ranks.clear();
+	m_Masks.clear();
+	m_HitCounters.clear();
+	m_iWadRank[0] = m_iWadRank[1] = 0;
+
+	// nothing is left to provide them
+	for( int i = 0; i < INDEX_SHARDS; i++ )
+	{
+		m_Files[i] = std::make_shared<indexFiles_t>();
+		m_Dirs[i] = std::make_shared<indexDirs_t>();
+	}
+}
+
+bool CSearchSnapshot::Search( const char *pattern, bool gamedironly, std::vector<std::string> &out, pathIDMask_t scope ) const
+{
+	if( !m_bActive )
+		return false;
+
+	std::string fixed, dir, key;
+	int which = gamedironly ? 1 : 0;
+
+	FixName( fixed, pattern );
+
+	size_t slash = fixed.rfind( '/' );
+	if( slash != std::string::npos )
+		dir = fixed.substr( 0, slash );
+
+	// only plain directories are indexed, and lumps may be hidden in wads
+	if( dir.find_first_of( "*?" ) != std::string::npos )
+		return false;
+
+	if( m_iWadRank[which] && IsWadExtension( fixed ))
+		return false;
+
+	MakeKey( key, dir );
+
+	const std::set<std::string> *children = Children( key );
+
+	// might be created after index was built
+	if( !children )
+		return false;
+
+	const indexEntry_t *dirEntry = dir.empty() ? NULL : Entry( key );
+	const std::string &realDir = dirEntry ? dirEntry->name : dir;
+
+	// files created in a directory nobody watches would be missed
+	for( size_t i = 0; i < m_Paths.size(); i++ )
+	{
+		searchpath_t *search = m_Paths[i];
+
+		if( search->pack || search->wad )
+			continue;
+
+		if(( which == 1 && !( search->flags & FS_GAMEDIRONLY_SEARCH_FLAGS )) || ( scope && !( m_Masks[i] & scope )))
+			continue;
+
+		if( !fileWatcher.CoversDir( search, realDir ))
+			return false;
+	}
+
+	const char *base = fixed.c_str() + ( slash == std::string::npos ? 0 : slash + 1 );
+
+	for( std::set<std::string>::const_iterator child = children->begin(); child != children->end(); ++child )
+	{
+		const indexEntry_t *entry = Entry( *child );
+
+		if( !entry || !entry->source[which].search )
+			continue;
+
+		size_t nameStart = entry->name.rfind( '/' );
+		const char *name = entry->name.c_str() + ( nameStart == std::string::npos ? 0 : nameStart + 1 );
+
+		if( !MatchPattern( name, base ))
+			continue;
+
+		// first source is in scope most of the time, otherwise search paths are asked
+		if( scope && !InScope( entry->source[which].search, scope ) && Locate( entry->name, entry->isDir, which, scope ) < 0 )
+			continue;
+
+		out.push_back( dir.empty() ? std::string( name ) : dir + "/" + name );
+	}
+
+	return true;
+}
+
+bool CSearchSnapshot::IsDirectory( const char *name ) const
+{
+	if( !m_bActive )
+		return false;
+
+	std::string fixed, key;
+
+	FixName( fixed, name );
+	MakeKey( key, fixed );
+
+	const indexEntry_t *entry = Entry( key );
+
+	return entry && entry->isDir;
+}
+
+CSearchIndex::CSearchIndex() : m_pCurrent( std::make_shared<CSearchSnapshot>() ), m_bActive( false ), m_pHead( NULL ), m_iGeneration( 0 )
+{
+}
+
+snapshotRef_t CSearchIndex::Edit() const
+{
+	return std::make_shared<CSearchSnapshot>( *m_pCurrent );
+}
+
+void CSearchIndex::Publish( const snapshotRef_t &next, bool pathsChanged )
+{
+	if( pathsChanged )
+		next->m_iGeneration = m_iGeneration + 1;
+
+	m_pHead = next->m_pHead;
+	m_bActive = next->m_bActive;
+
+	// generation is bumped last, so whoever sees it finds the snapshot too
+	std::atomic_store( &m_pCurrent, next );
+	m_iGeneration.store( next->m_iGeneration, std::memory_order_release );
+}
+
+void CSearchIndex::Build()
+{
+	snapshotRef_t next = std::make_shared<CSearchSnapshot>();
+
+	next->Build( m_pCurrent->m_Removed );
+	Publish( next, true );
+}
+
+void CSearchIndex::Clear()
+{
+	Publish( std::make_shared<CSearchSnapshot>(), true );
+}
+
+void CSearchIndex::Sync()
+{
+	searchpath_t *head = engine.FS_GetSearchPaths();
+
+	if( !m_bActive || head == m_pHead )
+		return;
+
+	snapshotRef_t next = Edit();
+
+	if( !next->Sync( head ))
+	{
+		Build();
+		return;
+	}
+
+	Publish( next, true );
+}
+
+void CSearchIndex::Update( const char *name )
+{
+	if( !m_bActive )
+		return;
+
+	Sync();
+
+	snapshotRef_t next = Edit();
+
+	next->Update( name );
+	Publish( next, false );
+}
+
+void CSearchIndex::Written( const char *name )
+{
+	if( !m_bActive )
+		return;
+
+	Sync();
+
+	if( !Pin()->Restat( name ))
+		Update( name );
+}
+
+void CSearchIndex::UpdateTree( searchpath_t *search, const char *dir )
+{
+	if( !m_bActive )
+		return;
+
+	Sync();
+
+	snapshotRef_t next = Edit();
+
+	next->UpdateTree( search, dir );
+	Publish( next, false );
+}
+
+bool CSearchIndex::Remove( searchpath_t *search, std::vector<std::string> &changed )
+{
+	if( !m_bActive )
+		return false;
+
+	Sync();
+
+	snapshotRef_t next = Edit();
+
+	if( !next->Remove( search, changed ))
+		return false;
+
+	// what engine answers doesn't change, so caches keep the rest
+	Publish( next, false );
+	return true;
+}
+
+void CSearchIndex::RemoveAll()
+{
+	if( !m_bActive )
+		return;
+
+	Sync();
+
+	snapshotRef_t next = Edit();
+
+	next->RemoveAll();
+	Publish( next, true );
+}
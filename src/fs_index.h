@@ -0,0 +1,211 @@
+/*
+fs_index.h - in-memory index of all files in search paths
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_INDEX_H
+#define FS_INDEX_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "fs_handle.h"
+#include "fs_pathid.h"
+#include "fs_lock.h"
+#include "fs_metrics.h"
+
+// where the file is taken from, for all search paths or for gamedir ones only
+struct indexSource_t
+{
+	searchpath_t *search;
+	int rank; // counted from the last search path, so prepending doesn't change it
+	fileOrigin_t origin;
+
+	bool haveStat;
+	fs_offset_t size;
+	long time;
+};
+
+struct indexEntry_t
+{
+	std::string name; // as found on disk or in pack
+	bool isDir;
+	indexSource_t source[2]; // [0] any search path, [1] gamedir search paths
+};
+
+#define INDEX_SHARDS 64 // parts of index copied separately when changed
+
+typedef std::unordered_map<std::string, indexEntry_t> indexFiles_t; // lowercased name
+typedef std::unordered_map<std::string, std::set<std::string> > indexDirs_t; // lowercased dir -> lowercased children
+
+// Search paths and everything in them at one moment. Never changes once
+// published, except stat results filled in place by Stat
+class CSearchSnapshot
+{
+public:
+	CSearchSnapshot();
+
+	bool IsActive() const { return m_bActive; }
+
+	// changes when search paths are added or all are removed, not with
+	// files in them. Removing one only changes names it provided
+	unsigned int Generation() const { return m_iGeneration; }
+
+	// in engine order, without removed ones
+	const std::vector<searchpath_t *> &Paths() const { return m_Paths; }
+
+	// NULL if file isn't known or engine must be asked instead
+	indexSource_t *Find( const char *name, bool gamedironly );
+
+	// first of search paths added with any of pathIDs in scope, scratch
+	// is filled and returned if it's not a source stored in index
+	indexSource_t *FindIn( const char *name, pathIDMask_t scope, indexSource_t *scratch );
+
+	// fill size and time for found file
+	bool Stat( indexSource_t *source, const char *name );
+
+	bool HasRemoved() const { return !m_Removed.empty(); }
+	bool IsRemoved( searchpath_t *search ) const { return search && m_Removed.count( search ); }
+
+	// build full path on disk for a loose file
+	static bool DiskPath( const indexSource_t *source, const char *name, char *out, size_t size );
+
+	// list directory contents matching the wildcard, false if can't be answered from index.
+	// With scope, only what search paths added with any of these pathIDs have
+	bool Search( const char *pattern, bool gamedironly, std::vector<std::string> &out, pathIDMask_t scope = 0 ) const;
+
+	// whether any search path in scope has this file or directory
+	bool HasIn( const char *name, pathIDMask_t scope ) const;
+
+	bool IsDirectory( const char *name ) const;
+
+private:
+	friend class CSearchIndex;
+
+	// only for a copy that isn't published yet
+	void Build( const std::unordered_set<searchpath_t *> &removed );
+	bool Sync( searchpath_t *head );
+	void Update( const char *name );
+	bool Restat( const char *name );
+	void UpdateTree( searchpath_t *search, const char *dir );
+	bool Remove( searchpath_t *search, std::vector<std::string> &changed );
+	void RemoveAll();
+
+	// Find without counting it in metrics
+	indexSource_t *Lookup( const char *name, bool gamedironly );
+	void CountHit( searchpath_t *search ) const;
+
+	indexEntry_t *Entry( const std::string &key );
+	const indexEntry_t *Entry( const std::string &key ) const;
+	const std::set<std::string> *Children( const std::string &dir ) const;
+
+	// shards are shared with older snapshots until they're changed
+	indexFiles_t &EditFiles( const std::string &key );
+	indexDirs_t &EditDirs( const std::string &dir );
+
+	void AddSearchPaths( const std::vector<searchpath_t *> &paths, const std::vector<int> &ranks );
+	void AddLooseDirectory( searchpath_t *search, int rank, const std::string &dir, int depth, indexFiles_t &added );
+	void AddPackFile( searchpath_t *search, int rank, indexFiles_t &added );
+	void AddEntry( indexFiles_t &added, const std::string &name, bool isDir, searchpath_t *search, int rank, fileOrigin_t origin );
+	void Merge( indexFiles_t &added );
+	void Reresolve( searchpath_t *search, const std::vector<std::string> &keys, std::vector<std::string> *changed );
+	void Subtree( const std::string &key, std::vector<std::string> &out ) const;
+	bool Trusted( const indexEntry_t &entry, int which ) const;
+	int Locate( const std::string &name, bool isDir, int which, pathIDMask_t scope = 0 ) const;
+	bool InScope( const searchpath_t *search, pathIDMask_t scope ) const;
+	void UpdateWadRanks();
+
+	bool m_bActive;
+	unsigned int m_iGeneration;
+	searchpath_t *m_pHead; // engine head this was taken from
+	std::vector<searchpath_t *> m_Paths;
+	std::vector<int> m_Ranks; // for each of m_Paths
+	std::vector<pathIDMask_t> m_Masks; // for each of m_Paths
+	std::unordered_map<searchpath_t *, CMetricCounter *> m_HitCounters; // for each of m_Paths, so hits take no locks
+	std::unordered_set<searchpath_t *> m_Removed;
+	int m_iTopRank;
+	int m_iWadRank[2]; // highest ranked wad, any and gamedir only
+
+	std::shared_ptr<indexFiles_t> m_Files[INDEX_SHARDS];
+	std::shared_ptr<indexDirs_t> m_Dirs[INDEX_SHARDS];
+};
+
+typedef std::shared_ptr<CSearchSnapshot> snapshotRef_t;
+
+// Maps every file in loose directories and packs to the search path
+// the engine would take it from. Only positive answers can be trusted:
+// wad lumps aren't indexed, so a miss must be asked from the engine.
+// Readers pin current snapshot and never wait for anyone. Changes are
+// made to a copy with searchPathLock held and then published, so a
+// search path being scanned doesn't stop lookups in the others
+class CSearchIndex
+{
+public:
+	CSearchIndex();
+
+	snapshotRef_t Pin() const { return std::atomic_load( &m_pCurrent ); }
+	bool IsActive() const { return m_bActive; }
+
+	// engine has search paths snapshot doesn't know about
+	bool IsStale() const { return m_bActive && m_pHead != engine.FS_GetSearchPaths(); }
+
+	// caches depending on search paths compare it with what they were filled with
+	unsigned int Generation() const { return m_iGeneration.load( std::memory_order_acquire ); }
+
+	// everything below needs searchPathLock
+	void Build();
+	void Clear();
+
+	// pick up search paths added after Build
+	void Sync();
+
+	// file was written or removed through us
+	void Update( const char *name );
+
+	// file was written through us, if it's already taken from write
+	// path only its size and time are refreshed, without a copy
+	void Written( const char *name );
+
+	// directory appeared in or vanished from loose search path,
+	// only what's under it is looked up again
+	void UpdateTree( searchpath_t *search, const char *dir );
+
+	// hide search path from everything that goes through us, only files
+	// it provided are looked up again in the rest of search paths, and
+	// their names are added to changed
+	bool Remove( searchpath_t *search, std::vector<std::string> &changed );
+	void RemoveAll();
+
+private:
+	snapshotRef_t Edit() const;
+	void Publish( const snapshotRef_t &next, bool pathsChanged );
+
+	snapshotRef_t m_pCurrent;
+	std::atomic<bool> m_bActive;
+	std::atomic<searchpath_t *> m_pHead;
+	std::atomic<unsigned int> m_iGeneration;
+};
+
+// case insensitive, '*' and '?' don't match '/'
+bool MatchPattern( const char *str, const char *pattern );
+
+extern CSearchIndex searchIndex;
+
+// serializes changes of search paths, lookups never take it
+extern std::mutex searchPathLock;
+
+#endif // FS_INDEX_H
@@ -0,0 +1,195 @@
+/*
+fs_levellog.cpp - per level file access recording and replay
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "fs_levellog.h"
+#include "fs_prefetch.h"
+#include "fs_index.h"
+#include "fs_lookup.h"
+#include "fs_content.h"
+
+CLevelLog levelLog;
+
+static std::string LowerName( const char *name )
+{
+	std::string s( name );
+
+	for( size_t i = 0; i < s.size(); i++ )
+		s[i] = s[i] == '\\' ? '/' : tolower( s[i] );
+
+	return s;
+}
+
+// "maps/c1a0.bsp" and "c1a0" are the same level
+bool CLevelLog::ManifestPath( const char *level, char *out, size_t size ) const
+{
+	if( !level )
+		return false;
+
+	const char *base = strrchr( level, '/' );
+
+	if( !base ) base = strrchr( level, '\\' );
+	base = base ? base + 1 : level;
+
+	char name[64];
+	size_t len = 0;
+
+	for( ; *base && *base != '.' && len < sizeof( name ) - 1; base++ )
+		name[len++] = isalnum( *base ) || *base == '_' || *base == '-' ? tolower( *base ) : '_';
+	name[len] = 0;
+
+	if( !len )
+		return false;
+
+	snprintf( out, size, LEVELLOG_DIR "/%s.lst", name );
+	return true;
+}
+
+void CLevelLog::Start( const char *level )
+{
+	char path[MAX_SYSPATH];
+
+	if( !ManifestPath( level, path, sizeof( path )))
+		return;
+
+	Replay( path );
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	m_Level = path;
+	m_Entries.clear();
+	m_Names.clear();
+	m_Open.clear();
+	m_bRecording = true;
+}
+
+void CLevelLog::Finish( const char *level )
+{
+	char path[MAX_SYSPATH];
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	if( !m_bRecording )
+		return;
+
+	m_bRecording = false;
+
+	if( !ManifestPath( level, path, sizeof( path )) || m_Level != path )
+		return; // some other level was finished, recording is useless
+
+	// count what was read from files still open
+	for( std::unordered_map<CFileHandle *, size_t>::iterator it = m_Open.begin(); it != m_Open.end(); ++it )
+		m_Entries[it->second].bytes += it->first->BytesRead();
+
+	// next Start may come while it's written
+	std::vector<levelLogEntry_t> entries;
+
+	entries.swap( m_Entries );
+	m_Names.clear();
+	m_Open.clear();
+	lock.unlock();
+
+	Write( path, entries );
+}
+
+void CLevelLog::Opened( CFileHandle *handle )
+{
+	if( !m_bRecording || handle->IsWritable() )
+		return;
+
+	std::string key = LowerName( handle->Name() );
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	if( !m_bRecording )
+		return;
+
+	std::unordered_map<std::string, size_t>::iterator it = m_Names.find( key );
+	size_t index;
+
+	if( it == m_Names.end() )
+	{
+		levelLogEntry_t entry;
+
+		entry.name = handle->Name();
+		entry.bytes = 0;
+
+		index = m_Entries.size();
+		m_Entries.push_back( entry );
+		m_Names[key] = index;
+	}
+	else index = it->second;
+
+	m_Open[handle] = index;
+}
+
+void CLevelLog::Closed( CFileHandle *handle )
+{
+	if( !m_bRecording )
+		return;
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	std::unordered_map<CFileHandle *, size_t>::iterator it = m_Open.find( handle );
+
+	if( it == m_Open.end() )
+		return;
+
+	m_Entries[it->second].bytes += handle->BytesRead();
+	m_Open.erase( it );
+}
+
+void CLevelLog::Replay( const char *path )
+{
+	if( !engine.FS_FileExists( path, false ))
+		return;
+
+	std::vector<std::string> tokens, names;
+
+	// pairs of name and bytes read
+	ParseResourceList( path, tokens );
+
+	for( size_t i = 0; i + 1 < tokens.size(); i += 2 )
+	{
+		// opened only to check it's there, nothing to warm
+		if( atol( tokens[i+1].c_str() ) > 0 )
+			names.push_back( tokens[i] );
+	}
+
+	prefetcher.Hint( names );
+}
+
+void CLevelLog::Write( const char *path, const std::vector<levelLogEntry_t> &entries )
+{
+	std::string data = "// files read during level load, in order: name, bytes read\n";
+	char line[MAX_SYSPATH + 32];
+
+	for( size_t i = 0; i < entries.size(); i++ )
+	{
+		snprintf( line, sizeof( line ), "\"%s\" %ld\n", entries[i].name.c_str(), (long)entries[i].bytes );
+		data += line;
+	}
+
+	// engine creates the directory in write dir itself
+	file_t *f = engine.FS_Open( path, "w", true );
+
+	if( !f )
+		return;
+
+	engine.FS_Write( f, data.c_str(), data.size() );
+	engine.FS_Close( f );
+
+	searchIndex.Update( path );
+	lookupCache.Invalidate( path );
+	contentCache.Invalidate( path );
+}
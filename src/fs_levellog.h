@@ -0,0 +1,67 @@
+/*
+fs_levellog.h - per level file access recording and replay
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_LEVELLOG_H
+#define FS_LEVELLOG_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include "fs_handle.h"
+
+// manifests are written to game dir, levelcache/<map>.lst
+#define LEVELLOG_DIR	"levelcache"
+
+struct levelLogEntry_t
+{
+	std::string name;
+	fs_offset_t bytes;
+};
+
+// Between LogLevelLoadStarted and LogLevelLoadFinished remembers every
+// file opened for reading, in order, with bytes read from it. Manifest
+// written at the end is used to preload same files on next load of the map
+class CLevelLog
+{
+public:
+	CLevelLog() : m_bRecording( false ) { }
+
+	// replay previous manifest and start recording
+	void Start( const char *level );
+
+	// write the manifest, if it's the level being recorded
+	void Finish( const char *level );
+
+	void Opened( CFileHandle *handle );
+	void Closed( CFileHandle *handle );
+
+private:
+	bool ManifestPath( const char *level, char *out, size_t size ) const;
+	void Replay( const char *path );
+	void Write( const char *path, const std::vector<levelLogEntry_t> &entries );
+
+	std::mutex m_Mutex;
+	std::atomic<bool> m_bRecording;
+	std::string m_Level;
+
+	std::vector<levelLogEntry_t> m_Entries; // in order of first open
+	std::unordered_map<std::string, size_t> m_Names; // lowercased name -> entry
+	std::unordered_map<CFileHandle *, size_t> m_Open; // handles not closed yet
+};
+
+extern CLevelLog levelLog;
+
+#endif // FS_LEVELLOG_H
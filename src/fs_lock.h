@@ -0,0 +1,69 @@
+/*
+fs_lock.h - locking primitives
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_LOCK_H
+#define FS_LOCK_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <mutex>
+
+// tables split into this many independently locked parts
+#define LOCK_SHARDS 16
+
+// std::shared_mutex is C++17
+class CRWLock
+{
+public:
+	CRWLock() { pthread_rwlock_init( &m_Lock, NULL ); }
+	~CRWLock() { pthread_rwlock_destroy( &m_Lock ); }
+
+	void LockShared() { pthread_rwlock_rdlock( &m_Lock ); }
+	void UnlockShared() { pthread_rwlock_unlock( &m_Lock ); }
+	void Lock() { pthread_rwlock_wrlock( &m_Lock ); }
+	void Unlock() { pthread_rwlock_unlock( &m_Lock ); }
+
+private:
+	CRWLock( const CRWLock & );
+	CRWLock &operator=( const CRWLock & );
+
+	pthread_rwlock_t m_Lock;
+};
+
+class CSharedLock
+{
+public:
+	explicit CSharedLock( CRWLock &lock ) : m_Lock( lock ) { m_Lock.LockShared(); }
+	~CSharedLock() { m_Lock.UnlockShared(); }
+
+private:
+	CRWLock &m_Lock;
+};
+
+class CExclusiveLock
+{
+public:
+	explicit CExclusiveLock( CRWLock &lock ) : m_Lock( lock ) { m_Lock.Lock(); }
+	~CExclusiveLock() { m_Lock.Unlock(); }
+
+private:
+	CRWLock &m_Lock;
+};
+
+inline size_t LockShard( size_t hash )
+{
+	return ( hash ^ ( hash >> 7 )) % LOCK_SHARDS;
+}
+
+#endif // FS_LOCK_H
@@ -0,0 +1,266 @@
+/*
+fs_lookup.cpp - file metadata lookup cache
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <sys/stat.h>
+#include "fs_lookup.h"
+#include "fs_index.h"
+
+CLookupCache lookupCache;
+
+#define KEY_ANY		'0'
+#define KEY_GAMEDIR	'1'
+#define KEY_DIRECTORY	'd' // raw path, not looked up in search paths
+
+// same file may be asked with different slashes
+static void MakeKey( std::string &key, const char *name, char kind )
+{
+	key.clear();
+	key += kind;
+
+	for( ; *name; name++ )
+	{
+		char c = *name == '\\' ? '/' : *name;
+
+		if( c == '/' && key[key.size() - 1] == '/' )
+			continue;
+
+		key += c;
+	}
+}
+
+// answer says there's no such file
+static bool IsMiss( const lookupEntry_t &entry, int flag )
+{
+	switch( flag )
+	{
+	case LOOKUP_HAVE_EXISTS: return !entry.exists;
+	case LOOKUP_HAVE_SIZE: return entry.size < 0;
+	case LOOKUP_HAVE_TIME: return entry.time < 0;
+	case LOOKUP_HAVE_FOUND: return !entry.found;
+	}
+
+	return false;
+}
+
+lookupShard_t &CLookupCache::Shard( const std::string &key )
+{
+	return m_Shards[LockShard( std::hash<std::string>()( key ))];
+}
+
+bool CLookupCache::Get( const std::string &key, int flag, unsigned int generation, lookupEntry_t &out )
+{
+	lookupShard_t &shard = Shard( key );
+	std::lock_guard<std::mutex> lock( shard.mutex );
+	std::unordered_map<std::string, lookupEntry_t>::iterator it = shard.entries.find( key );
+
+	if( it == shard.entries.end() || !( it->second.flags & flag ) || it->second.generation != generation
+		|| ( IsMiss( it->second, flag ) && Sys_MonotonicUsec() - it->second.missed > LOOKUP_MISS_MSEC * 1000LL ))
+	{
+		m_iMisses.fetch_add( 1, std::memory_order_relaxed );
+		return false;
+	}
+
+	m_iHits.fetch_add( 1, std::memory_order_relaxed );
+	out = it->second;
+	return true;
+}
+
+void CLookupCache::Set( const std::string &key, int flag, unsigned int generation, const lookupEntry_t &value )
+{
+	lookupShard_t &shard = Shard( key );
+	std::lock_guard<std::mutex> lock( shard.mutex );
+
+	// any entry will do, it's just asked again if it's needed
+	if( shard.entries.size() >= LOOKUP_SHARD_ENTRIES && !shard.entries.count( key ))
+		shard.entries.erase( shard.entries.begin() );
+
+	// fresh entries are zeroed by unordered_map, so flags tell nothing is known
+	lookupEntry_t &entry = shard.entries[key];
+
+	// search paths changed while engine was asked
+	if( entry.generation > generation )
+		return;
+
+	if( entry.generation < generation )
+	{
+		entry.flags = 0;
+		entry.generation = generation;
+	}
+
+	switch( flag )
+	{
+	case LOOKUP_HAVE_EXISTS: entry.exists = value.exists; break;
+	case LOOKUP_HAVE_SIZE: entry.size = value.size; break;
+	case LOOKUP_HAVE_TIME: entry.time = value.time; break;
+	case LOOKUP_HAVE_FOUND: entry.found = value.found; break;
+	}
+
+	if( IsMiss( entry, flag ))
+		entry.missed = Sys_MonotonicUsec();
+
+	entry.flags |= flag;
+}
+
+bool CLookupCache::FileExists( const char *name, bool gamedironly )
+{
+	std::string key;
+	lookupEntry_t entry;
+	unsigned int generation = searchIndex.Generation();
+
+	MakeKey( key, name, gamedironly ? KEY_GAMEDIR : KEY_ANY );
+
+	if( !Get( key, LOOKUP_HAVE_EXISTS, generation, entry ))
+	{
+		entry.exists = engine.FS_FindFile( name, NULL, gamedironly ) != NULL;
+		Set( key, LOOKUP_HAVE_EXISTS, generation, entry );
+	}
+
+	return entry.exists;
+}
+
+fs_offset_t CLookupCache::FileSize( const char *name, bool gamedironly )
+{
+	std::string key;
+	lookupEntry_t entry;
+	unsigned int generation = searchIndex.Generation();
+
+	MakeKey( key, name, gamedironly ? KEY_GAMEDIR : KEY_ANY );
+
+	if( !Get( key, LOOKUP_HAVE_SIZE, generation, entry ))
+	{
+		entry.size = engine.FS_FileSize( name, gamedironly );
+		Set( key, LOOKUP_HAVE_SIZE, generation, entry );
+	}
+
+	return entry.size;
+}
+
+long CLookupCache::FileTime( const char *name, bool gamedironly )
+{
+	std::string key;
+	lookupEntry_t entry;
+	unsigned int generation = searchIndex.Generation();
+
+	MakeKey( key, name, gamedironly ? KEY_GAMEDIR : KEY_ANY );
+
+	if( !Get( key, LOOKUP_HAVE_TIME, generation, entry ))
+	{
+		entry.time = engine.FS_FileTime( name, gamedironly );
+		Set( key, LOOKUP_HAVE_TIME, generation, entry );
+	}
+
+	return entry.time;
+}
+
+bool CLookupCache::IsRemoved( const CSearchSnapshot *index, const char *name, bool gamedironly )
+{
+	std::string key;
+	lookupEntry_t entry;
+	unsigned int generation = index->Generation();
+
+	MakeKey( key, name, gamedironly ? KEY_GAMEDIR : KEY_ANY );
+
+	// removing search paths doesn't change engine's answer, only what we do with it
+	if( !Get( key, LOOKUP_HAVE_FOUND, generation, entry ))
+	{
+		entry.found = engine.FS_FindFile( name, NULL, gamedironly );
+		Set( key, LOOKUP_HAVE_FOUND, generation, entry );
+	}
+
+	return index->IsRemoved( entry.found );
+}
+
+bool CLookupCache::IsDirectory( const char *path )
+{
+	std::string key;
+	lookupEntry_t entry;
+	unsigned int generation = searchIndex.Generation();
+
+	MakeKey( key, path, KEY_DIRECTORY );
+
+	if( !Get( key, LOOKUP_HAVE_EXISTS, generation, entry ))
+	{
+		struct stat buf;
+
+		entry.exists = stat( path, &buf ) != -1 && S_ISDIR( buf.st_mode );
+		Set( key, LOOKUP_HAVE_EXISTS, generation, entry );
+	}
+
+	return entry.exists;
+}
+
+void CLookupCache::Invalidate( const char *name )
+{
+	static const char kinds[] = { KEY_ANY, KEY_GAMEDIR, KEY_DIRECTORY };
+	std::string key;
+
+	for( size_t i = 0; i < sizeof( kinds ); i++ )
+	{
+		MakeKey( key, name, kinds[i] );
+
+		lookupShard_t &shard = Shard( key );
+		std::lock_guard<std::mutex> lock( shard.mutex );
+
+		shard.entries.erase( key );
+	}
+}
+
+void CLookupCache::InvalidateTree( const char *dir )
+{
+	std::string prefix;
+
+	// of any kind, so it's skipped when comparing
+	MakeKey( prefix, dir, KEY_ANY );
+
+	if( prefix[prefix.size() - 1] != '/' )
+		prefix += '/';
+
+	for( int i = 0; i < LOCK_SHARDS; i++ )
+	{
+		std::lock_guard<std::mutex> lock( m_Shards[i].mutex );
+		std::unordered_map<std::string, lookupEntry_t>::iterator it = m_Shards[i].entries.begin();
+
+		while( it != m_Shards[i].entries.end() )
+		{
+			if( !it->first.compare( 1, prefix.size() - 1, prefix, 1, std::string::npos ))
+				it = m_Shards[i].entries.erase( it );
+			else ++it;
+		}
+	}
+}
+
+void CLookupCache::Flush()
+{
+	for( int i = 0; i < LOCK_SHARDS; i++ )
+	{
+		std::lock_guard<std::mutex> lock( m_Shards[i].mutex );
+
+		m_Shards[i].entries.clear();
+	}
+}
+
+void CLookupCache::PrintStats()
+{
+	size_t entries = 0;
+
+	for( int i = 0; i < LOCK_SHARDS; i++ )
+	{
+		std::lock_guard<std::mutex> lock( m_Shards[i].mutex );
+
+		entries += m_Shards[i].entries.size();
+	}
+
+	engine.Msg( "FS_Stdio_Xash: lookup cache: %u hits, %u misses, %u entries\n",
+		Hits(), Misses(), (unsigned int)entries );
+}
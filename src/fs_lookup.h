@@ -0,0 +1,100 @@
+/*
+fs_lookup.h - file metadata lookup cache
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_LOOKUP_H
+#define FS_LOOKUP_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include "fs_engine.h"
+#include "fs_lock.h"
+
+#define LOOKUP_HAVE_EXISTS	(1<<0)
+#define LOOKUP_HAVE_SIZE	(1<<1)
+#define LOOKUP_HAVE_TIME	(1<<2)
+#define LOOKUP_HAVE_FOUND	(1<<3)
+
+#define LOOKUP_SHARD_ENTRIES	4096 // names are up to callers, so cache can't grow forever
+#define LOOKUP_MISS_MSEC	1000 // engine may create files without us knowing, e.g. downloads
+
+class CSearchSnapshot;
+
+struct lookupEntry_t
+{
+	int flags; // LOOKUP_HAVE_*, what is already known
+	unsigned int generation; // of search paths it was asked with
+	bool exists;
+	searchpath_t *found; // search path engine takes it from
+	fs_offset_t size;
+	long time;
+	long long missed; // usec when file was last found missing
+};
+
+struct lookupShard_t
+{
+	std::mutex mutex;
+	std::unordered_map<std::string, lookupEntry_t> entries;
+};
+
+// Remembers engine answers, both hits and misses, until
+// search paths or the file itself change. Entries from older
+// search path generations are ignored. Misses are only trusted
+// for LOOKUP_MISS_MSEC, as files engine writes by itself never
+// reach Invalidate. Split by name into shards, engine is asked
+// without any of them locked
+class CLookupCache
+{
+public:
+	CLookupCache() : m_iHits( 0 ), m_iMisses( 0 ) { }
+
+	bool FileExists( const char *name, bool gamedironly );
+	fs_offset_t FileSize( const char *name, bool gamedironly );
+	long FileTime( const char *name, bool gamedironly );
+
+	// search path engine would take the file from was removed by us
+	bool IsRemoved( const CSearchSnapshot *index, const char *name, bool gamedironly );
+
+	// stat of a raw path, only to be used when something tells when it changes
+	bool IsDirectory( const char *path );
+
+	// file was created, written or removed
+	void Invalidate( const char *name );
+
+	// everything under directory that appeared or vanished
+	void InvalidateTree( const char *dir );
+
+	// forget everything
+	void Flush();
+
+	unsigned int Hits() const { return m_iHits; }
+	unsigned int Misses() const { return m_iMisses; }
+	void PrintStats();
+
+private:
+	lookupShard_t &Shard( const std::string &key );
+
+	// copy of what is known, false if nothing
+	bool Get( const std::string &key, int flag, unsigned int generation, lookupEntry_t &out );
+	void Set( const std::string &key, int flag, unsigned int generation, const lookupEntry_t &value );
+
+	lookupShard_t m_Shards[LOCK_SHARDS];
+	std::atomic<unsigned int> m_iHits;
+	std::atomic<unsigned int> m_iMisses;
+};
+
+extern CLookupCache lookupCache;
+
+#endif // FS_LOOKUP_H
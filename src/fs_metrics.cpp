@@ -0,0 +1,222 @@
+/*
+fs_metrics.cpp - always on counters and latency histograms
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fs_metrics.h"
+#include "fs_pack.h"
+#include "filesystem_metrics.h"
+
+CMetrics metrics;
+
+static const char *counterNames[METRIC_COUNTERS] =
+{
+	"bytes.read",
+	"bytes.written",
+	"lookup.miss",
+};
+
+static const char *histogramNames[METRIC_HISTOGRAMS] =
+{
+	"latency.Open",
+	"latency.Read",
+	"latency.FindFirst",
+};
+
+void CMetricHistogram::Add( long long usec )
+{
+	int bucket = 0;
+
+	if( usec > 1 )
+		bucket = 64 - __builtin_clzll( usec - 1 );
+
+	if( bucket >= METRIC_BUCKETS )
+		bucket = METRIC_BUCKETS - 1;
+
+	m_Buckets[bucket].Add( 1 );
+	m_Total.Add( 1 );
+	m_Sum.Add( usec > 0 ? usec : 0 );
+}
+
+void CMetricHistogram::Reset()
+{
+	for( int i = 0; i < METRIC_BUCKETS; i++ )
+		m_Buckets[i].Reset();
+
+	m_Total.Reset();
+	m_Sum.Reset();
+}
+
+CMetrics::~CMetrics()
+{
+	Shutdown();
+}
+
+void CMetrics::Start()
+{
+	const char *env = getenv( METRICS_INTERVAL_ENV );
+
+	if( m_iInterval > 0 || !env || !getenv( METRICS_ENV ))
+		return;
+
+	int interval = atoi( env );
+
+	if( interval <= 0 )
+		return;
+
+	m_iInterval = interval;
+	m_bShutdown = false;
+	m_Thread = std::thread( &CMetrics::DumperThread, this );
+}
+
+void CMetrics::Shutdown()
+{
+	if( m_iInterval > 0 )
+	{
+		std::unique_lock<std::mutex> lock( m_Mutex );
+
+		m_bShutdown = true;
+		m_Cond.notify_all();
+		lock.unlock();
+
+		m_Thread.join();
+		m_iInterval = 0;
+	}
+
+	if( getenv( METRICS_ENV ))
+		Dump( NULL );
+}
+
+void CMetrics::DumperThread()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	while( !m_bShutdown )
+	{
+		if( m_Cond.wait_for( lock, std::chrono::seconds( m_iInterval )) != std::cv_status::timeout )
+			continue;
+
+		lock.unlock();
+		Dump( NULL );
+		lock.lock();
+	}
+}
+
+bool CMetrics::Dump( const char *path )
+{
+	if( !path && !( path = getenv( METRICS_ENV )))
+		return false;
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	std::string temp = std::string( path ) + ".tmp";
+	FILE *f = fopen( temp.c_str(), "w" );
+
+	if( !f )
+		return false;
+
+	fprintf( f, "uptime.sec %lld\n", ( Sys_MonotonicUsec() - m_iStarted ) / 1000000 );
+
+	for( int i = 0; i < METRIC_COUNTERS; i++ )
+		fprintf( f, "%s %llu\n", counterNames[i], m_Counters[i].Value() );
+
+	std::map<std::string, CMetricCounter *>::const_iterator it;
+
+	for( it = m_Named.begin(); it != m_Named.end(); ++it )
+		fprintf( f, "%s %llu\n", it->first.c_str(), it->second->Value() );
+
+	for( int i = 0; i < METRIC_HISTOGRAMS; i++ )
+	{
+		const CMetricHistogram &hist = m_Histograms[i];
+
+		fprintf( f, "%s.count %llu\n", histogramNames[i], hist.Total() );
+		fprintf( f, "%s.sum_usec %llu\n", histogramNames[i], hist.Sum() );
+
+		// empty buckets only clutter the dump
+		for( int j = 0; j < METRIC_BUCKETS; j++ )
+		{
+			if( !hist.Count( j ))
+				continue;
+
+			if( j == METRIC_BUCKETS - 1 )
+				fprintf( f, "%s.le_inf %llu\n", histogramNames[i], hist.Count( j ));
+			else fprintf( f, "%s.le_%lld %llu\n", histogramNames[i], CMetricHistogram::Bound( j ), hist.Count( j ));
+		}
+	}
+
+	bool ok = !ferror( f );
+
+	if( fclose( f ) || !ok || rename( temp.c_str(), path ))
+	{
+		remove( temp.c_str() );
+		return false;
+	}
+
+	return true;
+}
+
+void CMetrics::Reset()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	for( int i = 0; i < METRIC_COUNTERS; i++ )
+		m_Counters[i].Reset();
+
+	for( int i = 0; i < METRIC_HISTOGRAMS; i++ )
+		m_Histograms[i].Reset();
+
+	// search path counters are among these too
+	std::map<std::string, CMetricCounter *>::iterator it;
+
+	for( it = m_Named.begin(); it != m_Named.end(); ++it )
+		it->second->Reset();
+
+	m_iStarted = Sys_MonotonicUsec();
+}
+
+CMetricCounter *CMetrics::Counter( const char *group, const char *name )
+{
+	std::string key = std::string( group ) + "." + name;
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	CMetricCounter *&counter = m_Named[key];
+
+	if( !counter )
+		counter = new CMetricCounter;
+
+	return counter;
+}
+
+// named like RemoveSearchPath would take it
+CMetricCounter *CMetrics::SearchPathCounter( searchpath_t *search )
+{
+	const char *name = search->filename;
+	CPackFile *pack = Pack_ForSearchPath( search );
+
+	if( pack )
+		name = pack->Filename();
+
+	return Counter( "lookup.hit", name );
+}
+
+// extension interface, so a host can dump them whenever it wants
+class CFileSystemMetrics : public IFileSystemMetrics
+{
+public:
+	bool Dump( const char *path ) { return metrics.Dump( path ); }
+	void Reset() { metrics.Reset(); }
+};
+
+static CFileSystemMetrics fsMetrics;
+
+EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CFileSystemMetrics, IFileSystemMetrics, FILESYSTEM_METRICS_INTERFACE_VERSION, fsMetrics )
@@ -0,0 +1,143 @@
+/*
+fs_metrics.h - always on counters and latency histograms
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_METRICS_H
+#define FS_METRICS_H
+
+#include <string>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "fs_engine.h"
+
+#define METRICS_ENV				"FS_STDIO_METRICS" // file to dump metrics to at Unmount and by request
+#define METRICS_INTERVAL_ENV	"FS_STDIO_METRICS_INTERVAL" // also dump every this many seconds, unset or 0 to disable
+
+#define METRIC_BUCKETS 24 // powers of two of usec, last one takes everything longer
+
+class CMetricCounter
+{
+public:
+	CMetricCounter() : m_iValue( 0 ) { }
+
+	void Add( unsigned long long n ) { m_iValue.fetch_add( n, std::memory_order_relaxed ); }
+	unsigned long long Value() const { return m_iValue.load( std::memory_order_relaxed ); }
+	void Reset() { m_iValue.store( 0, std::memory_order_relaxed ); }
+
+private:
+	std::atomic<unsigned long long> m_iValue;
+};
+
+class CMetricHistogram
+{
+public:
+	void Add( long long usec );
+	void Reset();
+
+	// upper bound of bucket, in usec
+	static long long Bound( int bucket ) { return 1LL << bucket; }
+
+	unsigned long long Count( int bucket ) const { return m_Buckets[bucket].Value(); }
+	unsigned long long Total() const { return m_Total.Value(); }
+	unsigned long long Sum() const { return m_Sum.Value(); }
+
+private:
+	CMetricCounter m_Buckets[METRIC_BUCKETS];
+	CMetricCounter m_Total;
+	CMetricCounter m_Sum; // usec
+};
+
+enum metricCounterId_t
+{
+	METRIC_BYTES_READ = 0,
+	METRIC_BYTES_WRITTEN,
+	METRIC_LOOKUP_MISSES, // not in index, engine was asked
+	METRIC_COUNTERS
+};
+
+enum metricHistogramId_t
+{
+	METRIC_OPEN_TIME = 0,
+	METRIC_READ_TIME,
+	METRIC_FIND_TIME,
+	METRIC_HISTOGRAMS
+};
+
+// Everything is counted all the time with relaxed atomics, so it costs
+// next to nothing. Dumped as "name value" lines, to a temporary file
+// first, so readers never see it half written
+class CMetrics
+{
+public:
+	CMetrics() : m_bShutdown( false ), m_iInterval( 0 ), m_iStarted( Sys_MonotonicUsec() ) { }
+	~CMetrics();
+
+	// starts dumping thread if enabled by METRICS_INTERVAL_ENV
+	void Start();
+
+	// final dump to METRICS_ENV file and stop the thread
+	void Shutdown();
+
+	// NULL for METRICS_ENV file, false if there's no file or it can't be written
+	bool Dump( const char *path );
+	void Reset();
+
+	void Add( metricCounterId_t id, unsigned long long n ) { m_Counters[id].Add( n ); }
+	void Sample( metricHistogramId_t id, long long usec ) { m_Histograms[id].Add( usec ); }
+
+	// created on first use and never freed, so callers may keep the pointer
+	CMetricCounter *Counter( const char *group, const char *name );
+
+	// files found in this search path by index, looked up once when it's indexed
+	CMetricCounter *SearchPathCounter( searchpath_t *search );
+
+private:
+	void DumperThread();
+
+	CMetricCounter m_Counters[METRIC_COUNTERS];
+	CMetricHistogram m_Histograms[METRIC_HISTOGRAMS];
+
+	std::mutex m_Mutex; // named counters and dumping
+	std::map<std::string, CMetricCounter *> m_Named; // "group.name", sorted for dump
+
+	std::condition_variable m_Cond;
+	std::thread m_Thread;
+	bool m_bShutdown;
+	int m_iInterval; // sec
+	long long m_iStarted; // usec, for uptime
+};
+
+extern CMetrics metrics;
+
+// Adds time spent in scope to histogram
+class CMetricTimer
+{
+public:
+	explicit CMetricTimer( metricHistogramId_t id ) : m_Id( id ), m_iBegin( Sys_MonotonicUsec() ) { }
+	~CMetricTimer() { metrics.Sample( m_Id, Sys_MonotonicUsec() - m_iBegin ); }
+
+private:
+	metricHistogramId_t m_Id;
+	long long m_iBegin;
+};
+
+// counter is looked up once per call site, overloads need a name of their own
+#define COUNTCALL_NAMED( group, name ) \
+	static CMetricCounter *callCounter = metrics.Counter( group, name ); \
+	callCounter->Add( 1 )
+#define COUNTCALL( group )	COUNTCALL_NAMED( group, __FUNCTION__ )
+
+#endif // FS_METRICS_H
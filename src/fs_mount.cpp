@@ -0,0 +1,209 @@
+/*
+fs_mount.cpp - archives mounted with AddPackFile
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <algorithm>
+#include <unordered_set>
+#include "fs_mount.h"
+#include "fs_index.h"
+
+CPackMounts packMounts;
+
+static std::string LowerName( const char *name )
+{
+	std::string s( name );
+
+	for( size_t i = 0; i < s.size(); i++ )
+		s[i] = s[i] == '\\' ? '/' : tolower( s[i] );
+
+	return s;
+}
+
+static bool EntryBefore( const packEntry_t &entry, const std::string &name )
+{
+	return entry.name < name;
+}
+
+void CPackMounts::Publish( const std::shared_ptr<const mountList_t> &packs )
+{
+	std::atomic_store( &m_pPacks, packs );
+	m_iCount = packs->size();
+}
+
+bool CPackMounts::Mount( const char *fullpath, const char *pathID )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	const mountList_t &packs = *m_pPacks;
+
+	for( size_t i = 0; i < packs.size(); i++ )
+	{
+		if( !strcmp( packs[i].pack->Filename(), fullpath ))
+			return true;
+	}
+
+	CPackFile *pack = CPackFile::Load( fullpath );
+
+	if( !pack )
+		return false;
+
+	std::shared_ptr<mountList_t> next = std::make_shared<mountList_t>( packs );
+	mountedPack_t mount;
+
+	mount.pack.reset( pack );
+	mount.pathID = pathID ? pathID : "";
+	next->push_back( mount );
+
+	Publish( next );
+	return true;
+}
+
+bool CPackMounts::Unmount( const char *fullpath )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	const mountList_t &packs = *m_pPacks;
+
+	for( size_t i = 0; i < packs.size(); i++ )
+	{
+		if( !strcmp( packs[i].pack->Filename(), fullpath ))
+		{
+			std::shared_ptr<mountList_t> next = std::make_shared<mountList_t>( packs );
+
+			// freed when the last reader lets go, open handles have their own copy of data
+			next->erase( next->begin() + i );
+			Publish( next );
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CPackMounts::Clear()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	Publish( std::make_shared<mountList_t>() );
+}
+
+bool CPackMounts::Matches( const mountedPack_t &mount, const char *pathID, bool gamedironly ) const
+{
+	if( gamedironly )
+		return pathID && !mount.pathID.empty() && !strcasecmp( mount.pathID.c_str(), pathID );
+
+	return !pathID || mount.pathID.empty() || !strcasecmp( mount.pathID.c_str(), pathID );
+}
+
+std::shared_ptr<CPackFile> CPackMounts::Find( const char *name, const char *pathID, const packEntry_t **entry, bool gamedironly ) const
+{
+	std::shared_ptr<const mountList_t> packs = Pin();
+
+	for( size_t i = packs->size(); i-- > 0; )
+	{
+		const mountedPack_t &mount = ( *packs )[i];
+
+		if( !Matches( mount, pathID, gamedironly ))
+			continue;
+
+		const packEntry_t *found = mount.pack->FindEntry( name );
+
+		if( found )
+		{
+			if( entry ) *entry = found;
+			return mount.pack;
+		}
+	}
+
+	return std::shared_ptr<CPackFile>();
+}
+
+bool CPackMounts::IsDirectory( const char *name, const char *pathID ) const
+{
+	std::shared_ptr<const mountList_t> packs = Pin();
+
+	for( size_t i = 0; i < packs->size(); i++ )
+	{
+		if( Matches( ( *packs )[i], pathID ) && ( *packs )[i].pack->HasDirectory( name ))
+			return true;
+	}
+
+	return false;
+}
+
+CFileHandle *CPackMounts::Open( const char *name, const char *options, const char *pathID, bool gamedironly ) const
+{
+	// archives are read only
+	if( strpbrk( options, "wa+" ))
+		return NULL;
+
+	const packEntry_t *entry;
+	std::shared_ptr<CPackFile> pack = Find( name, pathID, &entry, gamedironly );
+
+	if( !pack )
+		return NULL;
+
+	void *data = pack->ReadEntry( entry );
+
+	if( !data )
+		return NULL;
+
+	CFileHandle *handle = new CFileHandle( new CMemoryBackend( data, entry->size ), name, options, pathID, gamedironly );
+
+	handle->SetSource( NULL, FILE_ORIGIN_PAK );
+	return handle;
+}
+
+void CPackMounts::Search( const char *pattern, const char *pathID, bool gamedironly, std::vector<std::string> &out ) const
+{
+	std::string fixed = LowerName( pattern ), dir;
+	size_t slash = fixed.rfind( '/' );
+
+	if( slash != std::string::npos )
+		dir = fixed.substr( 0, slash + 1 );
+
+	// like the index, wildcards only in the last component
+	if( dir.find_first_of( "*?" ) != std::string::npos )
+		return;
+
+	const char *base = fixed.c_str() + dir.size();
+	std::unordered_set<std::string> seen;
+
+	for( size_t i = 0; i < out.size(); i++ )
+		seen.insert( LowerName( out[i].c_str() ));
+
+	std::shared_ptr<const mountList_t> packs = Pin();
+
+	for( size_t i = packs->size(); i-- > 0; )
+	{
+		if( !Matches( ( *packs )[i], pathID, gamedironly ))
+			continue;
+
+		const std::vector<packEntry_t> &entries = ( *packs )[i].pack->Entries();
+		std::vector<packEntry_t>::const_iterator it = std::lower_bound( entries.begin(), entries.end(), dir, EntryBefore );
+
+		// everything under dir is contiguous in sorted entries
+		for( ; it != entries.end() && !it->name.compare( 0, dir.size(), dir ); ++it )
+		{
+			size_t end = it->name.find( '/', dir.size() );
+			std::string child = it->name.substr( 0, end );
+
+			if( !MatchPattern( child.c_str() + dir.size(), base ))
+				continue;
+
+			if( seen.insert( child ).second )
+				out.push_back( child );
+		}
+	}
+}
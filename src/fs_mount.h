@@ -0,0 +1,72 @@
+/*
+fs_mount.h - archives mounted with AddPackFile
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_MOUNT_H
+#define FS_MOUNT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "fs_pack.h"
+#include "fs_handle.h"
+
+struct mountedPack_t
+{
+	std::shared_ptr<CPackFile> pack;
+	std::string pathID; // empty is for any pathID
+};
+
+typedef std::vector<mountedPack_t> mountList_t; // in order of mounting
+
+// Engine knows nothing about these, so they're looked up by us
+// before going to engine's search paths: a mounted archive overrides
+// files of the game directory too, and later mounts win over earlier
+// ones. They aren't part of the game directory though, so gamedir only
+// lookups see only mounts made with exactly the pathID asked for.
+// Like the index, list is replaced as a whole and readers pin the one they use
+class CPackMounts
+{
+public:
+	CPackMounts() : m_pPacks( std::make_shared<mountList_t>() ), m_iCount( 0 ) { }
+
+	bool Mount( const char *fullpath, const char *pathID );
+	bool Unmount( const char *fullpath );
+	void Clear();
+	bool IsEmpty() const { return !m_iCount; }
+
+	// entry stays valid while pack is held
+	std::shared_ptr<CPackFile> Find( const char *name, const char *pathID, const packEntry_t **entry, bool gamedironly = false ) const;
+	bool IsDirectory( const char *name, const char *pathID ) const;
+
+	// read only handle with entry held in memory, NULL if there is no such entry
+	CFileHandle *Open( const char *name, const char *options, const char *pathID, bool gamedironly ) const;
+
+	// append matching files and directories, skipping ones already in out
+	void Search( const char *pattern, const char *pathID, bool gamedironly, std::vector<std::string> &out ) const;
+
+private:
+	bool Matches( const mountedPack_t &mount, const char *pathID, bool gamedironly = false ) const;
+	std::shared_ptr<const mountList_t> Pin() const { return std::atomic_load( &m_pPacks ); }
+	void Publish( const std::shared_ptr<const mountList_t> &packs );
+
+	std::mutex m_Mutex; // changes
+	std::shared_ptr<const mountList_t> m_pPacks;
+	std::atomic<int> m_iCount;
+};
+
+extern CPackMounts packMounts;
+
+#endif // FS_MOUNT_H
@@ -0,0 +1,439 @@
+/*
+fs_pack.cpp - pack file directory reader
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <mutex>
+#include <zlib.h>
+#include "fs_pack.h"
+
+#define IDPACKV1HEADER	(('K'<<24)+('C'<<16)+('A'<<8)+'P') // little-endian "PACK"
+#define PAK_MAX_NAME	56
+
+#define ZIP_LOCAL_SIG	0x04034b50
+#define ZIP_CENTRAL_SIG	0x02014b50
+#define ZIP_END_SIG	0x06054b50
+#define ZIP_LOCAL_SIZE	30
+#define ZIP_CENTRAL_SIZE	46
+#define ZIP_END_SIZE	22
+#define ZIP_MAX_COMMENT	0xffff
+#define ZIP_MAX_RATIO	1032 // deflate can't compress better than this
+
+struct dpackheader_t
+{
+	int ident;
+	int dirofs;
+	int dirlen;
+};
+
+struct dpackfile_t
+{
+	char name[PAK_MAX_NAME];
+	int filepos;
+	int filelen;
+};
+
+static void NormalizeEntryName( std::string &name )
+{
+	for( size_t i = 0; i < name.size(); i++ )
+	{
+		if( name[i] == '\\' )
+			name[i] = '/';
+		else name[i] = tolower( name[i] );
+	}
+}
+
+// zip fields aren't aligned, read them byte by byte
+static unsigned int ReadLE16( const unsigned char *p )
+{
+	return p[0] | ( p[1] << 8 );
+}
+
+static unsigned int ReadLE32( const unsigned char *p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (unsigned int)p[3] << 24 );
+}
+
+static bool EntryLess( const packEntry_t &a, const packEntry_t &b )
+{
+	return a.name < b.name;
+}
+
+CPackFile *CPackFile::Load( const char *filename )
+{
+	CPackFile *pack = new CPackFile;
+
+	struct stat st;
+
+	pack->m_szFilename = filename;
+	pack->m_iHandle = open( filename, O_RDONLY );
+
+	if( pack->m_iHandle < 0 || fstat( pack->m_iHandle, &st ) < 0 )
+	{
+		delete pack;
+		return NULL;
+	}
+
+	pack->m_iPackSize = st.st_size;
+
+	// engine reports pack modification time for all entries
+	pack->m_iFileTime = st.st_mtime;
+
+	if( !( pack->ReadPAKDirectory() || pack->ReadZIPDirectory() ))
+	{
+		delete pack;
+		return NULL;
+	}
+
+	pack->BuildLookup();
+
+	return pack;
+}
+
+CPackFile::~CPackFile()
+{
+	if( m_iHandle >= 0 )
+		close( m_iHandle );
+}
+
+bool CPackFile::ReadPAKDirectory()
+{
+	dpackheader_t header;
+
+	if( pread( m_iHandle, &header, sizeof( header ), 0 ) != sizeof( header ))
+		return false;
+
+	if( header.ident != IDPACKV1HEADER || header.dirlen < 0 || header.dirlen % sizeof( dpackfile_t ))
+		return false;
+
+	int numfiles = header.dirlen / sizeof( dpackfile_t );
+	dpackfile_t *info = (dpackfile_t *)malloc( header.dirlen + 1 );
+
+	if( !info )
+		return false;
+
+	if( pread( m_iHandle, info, header.dirlen, header.dirofs ) != header.dirlen )
+	{
+		free( info );
+		return false;
+	}
+
+	m_Entries.reserve( numfiles );
+	for( int i = 0; i < numfiles; i++ )
+	{
+		packEntry_t entry;
+
+		entry.name.assign( info[i].name, strnlen( info[i].name, PAK_MAX_NAME ));
+		NormalizeEntryName( entry.name );
+		entry.offset = info[i].filepos;
+		entry.size = entry.compressedSize = info[i].filelen;
+		entry.method = PACK_METHOD_STORED;
+
+		if( IsValidEntry( entry ))
+			m_Entries.push_back( entry );
+	}
+	free( info );
+
+	std::sort( m_Entries.begin(), m_Entries.end(), EntryLess );
+	return true;
+}
+
+bool CPackFile::ReadZIPDirectory()
+{
+	if( m_iPackSize < ZIP_END_SIZE )
+		return false;
+
+	// end of central directory is followed by a comment of unknown length
+	long tailLen = m_iPackSize < ZIP_END_SIZE + ZIP_MAX_COMMENT ? m_iPackSize : ZIP_END_SIZE + ZIP_MAX_COMMENT;
+	unsigned char *tail = (unsigned char *)malloc( tailLen );
+
+	if( !tail || pread( m_iHandle, tail, tailLen, m_iPackSize - tailLen ) != tailLen )
+	{
+		free( tail );
+		return false;
+	}
+
+	long end;
+
+	for( end = tailLen - ZIP_END_SIZE; end >= 0; end-- )
+	{
+		if( ReadLE32( tail + end ) == ZIP_END_SIG )
+			break;
+	}
+
+	if( end < 0 )
+	{
+		free( tail );
+		return false;
+	}
+
+	unsigned int numfiles = ReadLE16( tail + end + 10 );
+	unsigned int dirlen = ReadLE32( tail + end + 12 );
+	unsigned int dirofs = ReadLE32( tail + end + 16 );
+	free( tail );
+
+	if((off_t)dirofs + dirlen > m_iPackSize )
+		return false;
+
+	unsigned char *dir = (unsigned char *)malloc( dirlen + 1 );
+
+	if( !dir || pread( m_iHandle, dir, dirlen, dirofs ) != (ssize_t)dirlen )
+	{
+		free( dir );
+		return false;
+	}
+
+	unsigned char *p = dir, *dirEnd = dir + dirlen;
+
+	m_bZip = true;
+
+	m_Entries.reserve( numfiles );
+
+	for( unsigned int i = 0; i < numfiles && p + ZIP_CENTRAL_SIZE <= dirEnd; i++ )
+	{
+		if( ReadLE32( p ) != ZIP_CENTRAL_SIG )
+			break;
+
+		unsigned int flags = ReadLE16( p + 8 );
+		unsigned int nameLen = ReadLE16( p + 28 );
+		unsigned int skip = nameLen + ReadLE16( p + 30 ) + ReadLE16( p + 32 );
+
+		if( p + ZIP_CENTRAL_SIZE + skip > dirEnd )
+			break;
+
+		packEntry_t entry;
+
+		entry.name.assign( (const char *)p + ZIP_CENTRAL_SIZE, nameLen );
+		entry.method = ReadLE16( p + 10 );
+		entry.compressedSize = ReadLE32( p + 20 );
+		entry.size = ReadLE32( p + 24 );
+		entry.offset = ReadLE32( p + 42 );
+
+		p += ZIP_CENTRAL_SIZE + skip;
+
+		// directories, encrypted files and broken entries
+		if( entry.name.empty() || entry.name[entry.name.size() - 1] == '/' || ( flags & 1 ) || !IsValidEntry( entry ))
+			continue;
+
+		NormalizeEntryName( entry.name );
+		m_Entries.push_back( entry );
+	}
+	free( dir );
+
+	std::sort( m_Entries.begin(), m_Entries.end(), EntryLess );
+	return true;
+}
+
+// Sizes come from the file itself and can't be trusted: data must be
+// inside the pack, and unpacked size can't be more than deflate gives
+bool CPackFile::IsValidEntry( const packEntry_t &entry ) const
+{
+	if( entry.offset < 0 || entry.size < 0 || entry.compressedSize < 0 )
+		return false;
+
+	// zip entries also have a local header before data
+	off_t end = (off_t)entry.offset + entry.compressedSize + ( m_bZip ? ZIP_LOCAL_SIZE : 0 );
+
+	if( end > m_iPackSize )
+		return false;
+
+	if( entry.method == PACK_METHOD_STORED )
+		return entry.size == entry.compressedSize;
+
+	return (off_t)entry.size <= (off_t)entry.compressedSize * ZIP_MAX_RATIO + 64;
+}
+
+void CPackFile::BuildLookup()
+{
+	m_Lookup.reserve( m_Entries.size() );
+
+	for( size_t i = 0; i < m_Entries.size(); i++ )
+		m_Lookup[m_Entries[i].name] = i;
+}
+
+const packEntry_t *CPackFile::FindEntry( const char *name ) const
+{
+	std::string key = name;
+
+	NormalizeEntryName( key );
+
+	std::unordered_map<std::string, size_t>::const_iterator it = m_Lookup.find( key );
+
+	if( it == m_Lookup.end() )
+		return NULL;
+
+	return &m_Entries[it->second];
+}
+
+bool CPackFile::HasDirectory( const char *name ) const
+{
+	packEntry_t key;
+
+	key.name = name;
+	NormalizeEntryName( key.name );
+
+	if( key.name.empty() )
+		return false;
+
+	if( key.name[key.name.size() - 1] != '/' )
+		key.name += '/';
+
+	// everything under directory is right after it's name in sorted entries
+	std::vector<packEntry_t>::const_iterator it = std::lower_bound( m_Entries.begin(), m_Entries.end(), key, EntryLess );
+
+	return it != m_Entries.end() && !it->name.compare( 0, key.name.size(), key.name );
+}
+
+long CPackFile::DataOffset( const packEntry_t *entry ) const
+{
+	if( !m_bZip )
+		return entry->offset;
+
+	// local header repeats the name and may have different extra field
+	unsigned char local[ZIP_LOCAL_SIZE];
+
+	if( pread( m_iHandle, local, sizeof( local ), entry->offset ) != sizeof( local ) || ReadLE32( local ) != ZIP_LOCAL_SIG )
+		return -1;
+
+	long offset = entry->offset + ZIP_LOCAL_SIZE + ReadLE16( local + 26 ) + ReadLE16( local + 28 );
+
+	// name and extra field in local header may still push it past the end
+	if( (off_t)offset + entry->compressedSize > m_iPackSize )
+		return -1;
+
+	return offset;
+}
+
+void *CPackFile::ReadEntry( const packEntry_t *entry ) const
+{
+	long offset = DataOffset( entry );
+
+	if( offset < 0 || !IsValidEntry( *entry ))
+		return NULL;
+
+	char *data = (char *)malloc( entry->size + 1 );
+
+	if( !data )
+		return NULL;
+
+	data[entry->size] = 0;
+
+	if( entry->method == PACK_METHOD_STORED )
+	{
+		if( pread( m_iHandle, data, entry->size, offset ) == entry->size )
+			return data;
+	}
+	else if( entry->method == PACK_METHOD_DEFLATE )
+	{
+		unsigned char *packed = (unsigned char *)malloc( entry->compressedSize );
+		z_stream stream;
+		int ret = Z_DATA_ERROR;
+
+		memset( &stream, 0, sizeof( stream ));
+
+		if( packed && pread( m_iHandle, packed, entry->compressedSize, offset ) == entry->compressedSize
+			&& inflateInit2( &stream, -MAX_WBITS ) == Z_OK ) // raw deflate, no zlib header
+		{
+			stream.next_in = packed;
+			stream.avail_in = entry->compressedSize;
+			stream.next_out = (unsigned char *)data;
+			stream.avail_out = entry->size;
+
+			ret = inflate( &stream, Z_FINISH );
+			inflateEnd( &stream );
+		}
+
+		free( packed );
+
+		if( ret == Z_STREAM_END && stream.total_out == (unsigned long)entry->size )
+			return data;
+	}
+
+	free( data );
+	return NULL;
+}
+
+long CPackFile::StoredOffset( const packEntry_t *entry ) const
+{
+	if( entry->method != PACK_METHOD_STORED || !IsValidEntry( *entry ))
+		return -1;
+
+	return DataOffset( entry );
+}
+
+void *CPackFile::MapRange( long offset, long size, void **mapBase, size_t *mapLen ) const
+{
+	// pages past the end of file would fault when touched
+	if( offset < 0 || size < 0 || (off_t)offset + size > m_iPackSize )
+		return NULL;
+
+	long pageSize = sysconf( _SC_PAGESIZE );
+	long aligned = offset - offset % pageSize;
+
+	*mapLen = size + ( offset - aligned );
+	*mapBase = mmap( NULL, *mapLen, PROT_READ, MAP_PRIVATE, m_iHandle, aligned );
+
+	if( *mapBase == MAP_FAILED )
+	{
+		*mapBase = NULL;
+		return NULL;
+	}
+
+	return (char *)*mapBase + ( offset - aligned );
+}
+
+// =====================================
+// engine pack lookup
+
+static std::unordered_map<pack_t *, CPackFile *> s_Packs;
+static std::mutex s_PacksMutex;
+
+CPackFile *Pack_ForSearchPath( searchpath_t *search )
+{
+	if( !search || !search->pack )
+		return NULL;
+
+	// pack_t is opaque to us, but the engine keeps pack filename as it's first member.
+	// Don't trust that blindly: it must look like a path to a .pak and parse as one.
+	const char *filename = (const char *)search->pack;
+	size_t len = strnlen( filename, MAX_SYSPATH );
+
+	if( len < 4 || len == MAX_SYSPATH || strcasecmp( filename + len - 4, ".pak" ))
+		return NULL;
+
+	std::lock_guard<std::mutex> lock( s_PacksMutex );
+	std::unordered_map<pack_t *, CPackFile *>::iterator it = s_Packs.find( search->pack );
+
+	if( it != s_Packs.end() )
+	{
+		if( !it->second || !strcmp( it->second->Filename(), filename ))
+			return it->second;
+
+		// pack_t was reallocated for another file
+		delete it->second;
+		s_Packs.erase( it );
+	}
+
+	CPackFile *pack = CPackFile::Load( filename );
+	s_Packs[search->pack] = pack;
+
+	return pack;
+}
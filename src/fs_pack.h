@@ -0,0 +1,81 @@
+/*
+fs_pack.h - pack file directory reader
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_PACK_H
+#define FS_PACK_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "fs_engine.h"
+
+#define PACK_METHOD_STORED	0
+#define PACK_METHOD_DEFLATE	8
+
+struct packEntry_t
+{
+	std::string name; // lowercased, forward slashes
+	long offset; // data in PAK, local header in ZIP
+	long size;
+	long compressedSize;
+	int method;
+};
+
+// Read-only view of a PAK or PK3/ZIP directory, so entries can be
+// located without going through the engine's opaque pack_t
+class CPackFile
+{
+public:
+	static CPackFile *Load( const char *filename );
+	~CPackFile();
+
+	const packEntry_t *FindEntry( const char *name ) const;
+	bool HasDirectory( const char *name ) const;
+	const std::vector<packEntry_t> &Entries() const { return m_Entries; }
+	const char *Filename() const { return m_szFilename.c_str(); }
+	long FileTime() const { return m_iFileTime; }
+	bool IsZip() const { return m_bZip; }
+
+	// whole entry, decompressed, malloc'ed and zero terminated
+	void *ReadEntry( const packEntry_t *entry ) const;
+
+	// where stored entry's data starts in the pack file, -1 if it's compressed or broken
+	long StoredOffset( const packEntry_t *entry ) const;
+	int Handle() const { return m_iHandle; }
+
+	// map [offset, offset + size) of the pack file, returns pointer to the first byte
+	void *MapRange( long offset, long size, void **mapBase, size_t *mapLen ) const;
+
+private:
+	CPackFile() : m_iHandle( -1 ), m_iPackSize( 0 ), m_iFileTime( 0 ), m_bZip( false ) { }
+	bool ReadPAKDirectory();
+	bool ReadZIPDirectory();
+	bool IsValidEntry( const packEntry_t &entry ) const;
+	long DataOffset( const packEntry_t *entry ) const;
+	void BuildLookup();
+
+	std::string m_szFilename;
+	int m_iHandle;
+	off_t m_iPackSize; // entries are checked against it, truncated packs don't fault when mapped
+	long m_iFileTime;
+	bool m_bZip;
+	std::vector<packEntry_t> m_Entries; // sorted by name
+	std::unordered_map<std::string, size_t> m_Lookup; // name -> entry
+};
+
+// pack file backing engine's search path, NULL if it isn't a pack
+// or its directory can't be read
+CPackFile *Pack_ForSearchPath( searchpath_t *search );
+
+#endif // FS_PACK_H
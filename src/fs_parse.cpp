@@ -0,0 +1,117 @@
+/*
+fs_parse.cpp - COM_Parse compatible tokenizer
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <string.h>
+#include "fs_parse.h"
+
+enum
+{
+	CHAR_WORD = 0,
+	CHAR_END, // terminator
+	CHAR_SPACE,
+	CHAR_SINGLE // token on it's own, also ends a word
+};
+
+// one lookup per character instead of a chain of compares
+static const struct charClasses_t
+{
+	unsigned char table[256];
+
+	charClasses_t()
+	{
+		for( int i = 0; i < 256; i++ )
+			table[i] = i <= ' ' ? CHAR_SPACE : CHAR_WORD;
+
+		table[0] = CHAR_END;
+		table['{'] = table['}'] = CHAR_SINGLE;
+		table['('] = table[')'] = CHAR_SINGLE;
+		table['\''] = table[','] = CHAR_SINGLE;
+	}
+} charClasses;
+
+#define CharClass( c ) charClasses.table[(unsigned char)(c)]
+
+char *ParseToken( char *data, char *token, bool *wasQuoted )
+{
+	int len = 0;
+
+	if( wasQuoted )
+		*wasQuoted = false;
+
+	if( token )
+		token[0] = 0;
+
+	if( !data || !token )
+		return NULL;
+
+	while( 1 )
+	{
+		while( CharClass( *data ) == CHAR_SPACE )
+			data++;
+
+		if( !*data )
+			return NULL;
+
+		if( data[0] != '/' || data[1] != '/' )
+			break;
+
+		// comment runs to the end of line, library finds it faster than we would
+		data = strchr( data, '\n' );
+
+		if( !data )
+			return NULL;
+	}
+
+	if( *data == '"' )
+	{
+		char *start = ++data;
+
+		data += strcspn( data, "\"" );
+		len = data - start;
+
+		if( len > PARSE_TOKEN_MAX - 1 )
+			len = PARSE_TOKEN_MAX - 1;
+
+		memcpy( token, start, len );
+		token[len] = 0;
+
+		if( wasQuoted )
+			*wasQuoted = true;
+
+		// unterminated string ends with the data
+		return *data ? data + 1 : data;
+	}
+
+	if( CharClass( *data ) == CHAR_SINGLE )
+	{
+		token[0] = *data;
+		token[1] = 0;
+		return data + 1;
+	}
+
+	char *start = data;
+
+	while( CharClass( *data ) == CHAR_WORD )
+		data++;
+
+	len = data - start;
+
+	if( len > PARSE_TOKEN_MAX - 1 )
+		len = PARSE_TOKEN_MAX - 1;
+
+	memcpy( token, start, len );
+	token[len] = 0;
+
+	return data;
+}
@@ -0,0 +1,27 @@
+/*
+fs_parse.h - COM_Parse compatible tokenizer
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_PARSE_H
+#define FS_PARSE_H
+
+// same as com_token in GoldSrc, longer tokens are cut
+#define PARSE_TOKEN_MAX	1024
+
+// Takes next token from data into token, like COM_Parse: whitespace
+// and // comments are skipped, quoted strings are one token and
+// { } ( ) ' , are tokens on their own. Returns position after the
+// token or NULL when there are no more tokens
+char *ParseToken( char *data, char *token, bool *wasQuoted );
+
+#endif // FS_PARSE_H
@@ -0,0 +1,140 @@
+/*
+fs_pathid.cpp - interned pathIDs
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <string.h>
+#include <ctype.h>
+#include "fs_pathid.h"
+
+CPathIDTable pathIDs;
+
+static const char *builtinPathIDs[] =
+{
+	"GAME",
+	"BASE",
+	"GAMECONFIG",
+	"PLATFORM",
+	"DEFAULTGAMEDIR",
+};
+
+static bool IsGameDirName( const char *pathID )
+{
+	// same test as before, GAMECONFIG and DEFAULTGAMEDIR are gamedir ones too
+	return strstr( pathID, "GAME" ) || strstr( pathID, "BASE" );
+}
+
+CPathIDTable::CPathIDTable()
+{
+	m_iCount = 0;
+	m_iNextBit = 0;
+
+	Add( "", PATHID_BUILTIN );
+
+	// these don't need a bit
+	for( size_t i = 0; i < sizeof( builtinPathIDs ) / sizeof( builtinPathIDs[0] ); i++ )
+		Add( builtinPathIDs[i], PATHID_BUILTIN | ( IsGameDirName( builtinPathIDs[i] ) ? PATHID_GAMEDIR : 0 ));
+}
+
+// called with m_Lock held exclusively
+int CPathIDTable::Add( const char *pathID, int flags )
+{
+	pathIDInfo_t &info = m_IDs[m_iCount];
+	std::string key;
+
+	for( const char *p = pathID; *p; p++ )
+		key += toupper( *p );
+
+	info.name = pathID;
+	info.flags = flags;
+	info.bit = 0;
+	info.paths = 0;
+
+	m_Names[key] = m_iCount;
+	return m_iCount++;
+}
+
+int CPathIDTable::Intern( const char *pathID )
+{
+	if( !pathID || !pathID[0] )
+		return PATHID_ANY;
+
+	std::string key;
+
+	for( const char *p = pathID; *p; p++ )
+		key += toupper( *p );
+
+	{
+		CSharedLock lock( m_Lock );
+		std::unordered_map<std::string, int>::iterator it = m_Names.find( key );
+
+		if( it != m_Names.end() )
+			return it->second;
+	}
+
+	CExclusiveLock lock( m_Lock );
+	std::unordered_map<std::string, int>::iterator it = m_Names.find( key );
+
+	if( it != m_Names.end() )
+		return it->second;
+
+	// out of room, still keep gamedir ones right
+	if( m_iCount == MAX_PATHIDS )
+		return IsGameDirName( pathID ) ? m_Names["GAME"] : PATHID_ANY;
+
+	return Add( pathID, IsGameDirName( pathID ) ? PATHID_GAMEDIR : 0 );
+}
+
+bool CPathIDTable::IsScoped( int id ) const
+{
+	const pathIDInfo_t &info = m_IDs[id];
+
+	return !( info.flags & PATHID_BUILTIN ) && info.bit && info.paths;
+}
+
+pathIDMask_t CPathIDTable::Mask( searchpath_t *search ) const
+{
+	std::unordered_map<searchpath_t *, pathIDMask_t>::const_iterator it = m_Masks.find( search );
+
+	return it == m_Masks.end() ? 0 : it->second;
+}
+
+void CPathIDTable::Assign( int id, searchpath_t *search )
+{
+	pathIDInfo_t &info = m_IDs[id];
+
+	if( info.flags & PATHID_BUILTIN )
+		return;
+
+	// first search path with it, bit is set before paths so IsScoped sees it
+	if( !info.bit )
+	{
+		if( m_iNextBit == MAX_PATHID_BITS )
+			return;
+
+		info.bit = 1U << m_iNextBit++;
+	}
+
+	if( m_Masks[search] & info.bit )
+		return;
+
+	m_Masks[search] |= info.bit;
+	info.paths++;
+}
+
+void CPathIDTable::Clear()
+{
+	m_Masks.clear();
+
+	for( int i = 0; i < m_iCount; i++ )
+		m_IDs[i].paths = 0;
+}
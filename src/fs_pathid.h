@@ -0,0 +1,82 @@
+/*
+fs_pathid.h - interned pathIDs
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_PATHID_H
+#define FS_PATHID_H
+
+#include <string>
+#include <unordered_map>
+#include <atomic>
+#include "fs_engine.h"
+#include "fs_lock.h"
+
+typedef unsigned int pathIDMask_t;
+
+#define PATHID_ANY		0 // NULL or empty pathID
+#define MAX_PATHID_BITS	32 // pathIDs given to search paths after that can't be scoped
+#define MAX_PATHIDS		256 // later ones are taken as GAME or no pathID
+
+#define PATHID_GAMEDIR	(1<<0) // gamedir search paths only
+#define PATHID_BUILTIN	(1<<1) // engine's own, never scoped to search paths
+
+struct pathIDInfo_t
+{
+	std::string name;
+	int flags;
+	std::atomic<pathIDMask_t> bit; // 0 until given to a search path, or if none are left
+	std::atomic<int> paths; // search paths added with it
+};
+
+// pathID strings mapped to small numbers once, so lookups test flags
+// and bitmasks. Custom pathIDs given to AddSearchPath are scoped to the
+// search paths that were added with them, only these take a bit, so
+// pathIDs only ever looked up don't use them up. Entries never move once
+// interned, so only Intern locks; search path assignments follow
+// searchPathLock, lookups take masks from index snapshot instead
+class CPathIDTable
+{
+public:
+	CPathIDTable();
+
+	int Intern( const char *pathID );
+
+	bool IsGameDir( int id ) const { return m_IDs[id].flags & PATHID_GAMEDIR; }
+
+	// only custom pathIDs that have search paths of their own
+	bool IsScoped( int id ) const;
+	pathIDMask_t Bit( int id ) const { return m_IDs[id].bit; }
+
+	// all pathIDs search path was added with
+	pathIDMask_t Mask( searchpath_t *search ) const;
+
+	void Assign( int id, searchpath_t *search );
+
+	// search paths are gone, names are kept
+	void Clear();
+
+private:
+	int Add( const char *pathID, int flags );
+
+	pathIDInfo_t m_IDs[MAX_PATHIDS];
+	int m_iCount;
+
+	CRWLock m_Lock; // m_Names and adding to m_IDs
+	std::unordered_map<std::string, int> m_Names; // uppercased
+	std::unordered_map<searchpath_t *, pathIDMask_t> m_Masks;
+	int m_iNextBit;
+};
+
+extern CPathIDTable pathIDs;
+
+#endif // FS_PATHID_H
@@ -0,0 +1,246 @@
+/*
+fs_pathtrie.cpp - canonical search path prefixes
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "fs_pathtrie.h"
+#include "fs_index.h"
+
+CPathTrie pathTrie;
+
+// absolute, without . and .. or repeated slashes, so realpath
+// could only change it by resolving symlinks
+static bool LooksCanonical( const char *path )
+{
+	if( path[0] != '/' )
+		return false;
+
+	for( const char *p = path; *p; p++ )
+	{
+		if( *p != '/' )
+			continue;
+
+		if( p[1] == '/' )
+			return false;
+
+		if( p[1] == '.' && ( !p[2] || p[2] == '/' || ( p[2] == '.' && ( !p[3] || p[3] == '/' ))))
+			return false;
+	}
+
+	return true;
+}
+
+void CPathTrie::Flush()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	Clear();
+}
+
+void CPathTrie::Remove( searchpath_t *search )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	if( !m_pRoot || search->wad || search->pack )
+		return;
+
+	char *real = realpath( search->filename, NULL );
+
+	if( !real )
+		return;
+
+	pathTrieNode_t *node = Node( real );
+
+	// nodes are left, they're freed with the rest of trie
+	if( node )
+		node->order = -1;
+
+	free( real );
+}
+
+void CPathTrie::Clear()
+{
+	if( m_pRoot )
+		Free( m_pRoot );
+
+	m_pRoot = NULL;
+	m_iGeneration = 0;
+}
+
+void CPathTrie::Free( pathTrieNode_t *node )
+{
+	std::unordered_map<std::string, pathTrieNode_t *>::iterator it;
+
+	for( it = node->children.begin(); it != node->children.end(); ++it )
+		Free( it->second );
+
+	delete node;
+}
+
+void CPathTrie::Build()
+{
+	Clear();
+
+	snapshotRef_t index = searchIndex.Pin();
+	std::vector<searchpath_t *> paths = index->Paths();
+
+	// not mounted yet
+	if( !index->IsActive() )
+	{
+		for( searchpath_t *search = engine.FS_GetSearchPaths(); search; search = search->next )
+			paths.push_back( search );
+	}
+
+	m_pRoot = new pathTrieNode_t;
+	m_pRoot->order = -1;
+	m_iGeneration = index->Generation();
+
+	for( size_t i = 0; i < paths.size(); i++ )
+	{
+		if( paths[i]->wad || paths[i]->pack )
+			continue;
+
+		char *real = realpath( paths[i]->filename, NULL );
+
+		if( !real )
+			continue;
+
+		Insert( real, i );
+		free( real );
+	}
+}
+
+void CPathTrie::Insert( const char *path, int order )
+{
+	pathTrieNode_t *node = m_pRoot;
+
+	while( *path )
+	{
+		const char *end = strchr( path, '/' );
+		size_t len = end ? end - path : strlen( path );
+
+		if( len )
+		{
+			pathTrieNode_t *&child = node->children[std::string( path, len )];
+
+			if( !child )
+			{
+				child = new pathTrieNode_t;
+				child->order = -1;
+			}
+
+			node = child;
+		}
+
+		path += len;
+		if( *path ) path++;
+	}
+
+	// same directory may be added twice, first one wins
+	if( node->order < 0 || order < node->order )
+		node->order = order;
+}
+
+// exactly this path, NULL if it isn't there
+pathTrieNode_t *CPathTrie::Node( const char *path ) const
+{
+	pathTrieNode_t *node = m_pRoot;
+
+	while( *path && node )
+	{
+		const char *end = strchr( path, '/' );
+		size_t len = end ? end - path : strlen( path );
+
+		if( len )
+		{
+			std::unordered_map<std::string, pathTrieNode_t *>::const_iterator it = node->children.find( std::string( path, len ));
+
+			node = it == node->children.end() ? NULL : it->second;
+		}
+
+		path += len;
+		if( *path ) path++;
+	}
+
+	return node;
+}
+
+// finds length of the prefix belonging to first search path
+bool CPathTrie::Walk( const char *path, size_t *prefixLen ) const
+{
+	const pathTrieNode_t *node = m_pRoot;
+	const char *p = path;
+	int best = -1;
+
+	while( *p && node )
+	{
+		const char *end = strchr( p, '/' );
+		size_t len = end ? end - p : strlen( p );
+
+		if( len )
+		{
+			std::unordered_map<std::string, pathTrieNode_t *>::const_iterator it = node->children.find( std::string( p, len ));
+
+			node = it == node->children.end() ? NULL : it->second;
+
+			// only directories, file itself can't be a search path
+			if( node && node->order >= 0 && p[len] && ( best < 0 || node->order < best ))
+			{
+				best = node->order;
+				*prefixLen = p + len - path;
+			}
+		}
+
+		p += len;
+		if( *p ) p++;
+	}
+
+	return best >= 0;
+}
+
+bool CPathTrie::Relative( const char *fullpath, std::string &relative )
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	if( !m_pRoot || m_iGeneration != searchIndex.Generation() )
+		Build();
+
+	size_t prefixLen;
+
+	if( LooksCanonical( fullpath ) && Walk( fullpath, &prefixLen ))
+	{
+		relative = fullpath + prefixLen + 1;
+		return true;
+	}
+
+	lock.unlock();
+	char *real = realpath( fullpath, NULL );
+
+	if( !real )
+		return false;
+
+	// search paths may have changed meanwhile
+	lock.lock();
+
+	if( !m_pRoot || m_iGeneration != searchIndex.Generation() )
+		Build();
+
+	bool found = Walk( real, &prefixLen );
+
+	if( found )
+		relative = real + prefixLen + 1;
+
+	free( real );
+	return found;
+}
@@ -0,0 +1,62 @@
+/*
+fs_pathtrie.h - canonical search path prefixes
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_PATHTRIE_H
+#define FS_PATHTRIE_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include "fs_engine.h"
+
+struct pathTrieNode_t
+{
+	std::unordered_map<std::string, pathTrieNode_t *> children; // by path component
+	int order; // of search path ending here in engine order, -1 if none
+};
+
+// Real paths of loose search directories, split by components, so
+// a full path is matched with a single walk instead of realpath
+// for every search path
+class CPathTrie
+{
+public:
+	CPathTrie() : m_pRoot( NULL ), m_iGeneration( 0 ) { }
+	~CPathTrie() { Flush(); }
+
+	// free it, built again when asked
+	void Flush();
+
+	// search path was removed, rest of them stay
+	void Remove( searchpath_t *search );
+
+	// path relative to the first search path containing it
+	bool Relative( const char *fullpath, std::string &relative );
+
+private:
+	void Clear();
+	void Build();
+	void Insert( const char *path, int order );
+	bool Walk( const char *path, size_t *prefixLen ) const;
+	pathTrieNode_t *Node( const char *path ) const;
+	void Free( pathTrieNode_t *node );
+
+	std::mutex m_Mutex; // built lazily by whoever asks first
+	pathTrieNode_t *m_pRoot;
+	unsigned int m_iGeneration; // of search paths it was built for
+};
+
+extern CPathTrie pathTrie;
+
+#endif // FS_PATHTRIE_H
@@ -0,0 +1,407 @@
+/*
+fs_prefetch.cpp - background resource preloading
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fs_prefetch.h"
+#include "fs_index.h"
+#include "fs_pack.h"
+#include "fs_sched.h"
+
+// small enough for foreground I/O to not wait for long
+#define PREFETCH_CHUNK	(64 * 1024)
+
+CPrefetcher prefetcher;
+
+static bool IsListSeparator( char c )
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == ';';
+}
+
+static void TokenizeResourceList( const char *data, const char *end, std::vector<std::string> &names )
+{
+	while( data < end )
+	{
+		if( IsListSeparator( *data ))
+		{
+			data++;
+			continue;
+		}
+
+		// skip comments
+		if( data[0] == '/' && data + 1 < end && data[1] == '/' )
+		{
+			while( data < end && *data != '\n' )
+				data++;
+			continue;
+		}
+
+		const char *start;
+
+		if( *data == '"' )
+		{
+			start = ++data;
+			while( data < end && *data != '"' && *data != '\n' )
+				data++;
+		}
+		else
+		{
+			start = data;
+			while( data < end && !IsListSeparator( *data ))
+				data++;
+		}
+
+		if( data > start )
+			names.push_back( std::string( start, data - start ));
+
+		if( data < end && *data == '"' )
+			data++;
+	}
+}
+
+void ParseResourceList( const char *list, std::vector<std::string> &names )
+{
+	if( !list || !*list )
+		return;
+
+	const char *end = list + strlen( list );
+	const char *p;
+
+	for( p = list; p < end && !IsListSeparator( *p ); p++ );
+
+	const char *ext = strrchr( list, '.' );
+
+	// single word may be a name of list file, otherwise it's a resource on it's own
+	// and there's no need to read it here on game thread
+	if( p == end && ext && ( !strcasecmp( ext, ".res" ) || !strcasecmp( ext, ".lst" ) || !strcasecmp( ext, ".txt" )))
+	{
+		file_t *f = engine.FS_Open( list, "rb", false );
+
+		if( f )
+		{
+			std::string data;
+			char buf[4096];
+			fs_offset_t len;
+
+			while(( len = engine.FS_Read( f, buf, sizeof( buf ))) > 0 )
+				data.append( buf, len );
+
+			engine.FS_Close( f );
+
+			TokenizeResourceList( data.c_str(), data.c_str() + data.size(), names );
+			return;
+		}
+	}
+
+	TokenizeResourceList( list, end, names );
+}
+
+CPrefetcher::~CPrefetcher()
+{
+	Shutdown();
+}
+
+int CPrefetcher::Hint( const char *hintlist, bool forgetEverything )
+{
+	std::vector<std::string> names;
+
+	if( forgetEverything )
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		std::deque<prefetchJob_t>::iterator it = m_Queue.begin();
+
+		while( it != m_Queue.end() )
+		{
+			if( it->group == 0 )
+				it = m_Queue.erase( it );
+			else ++it;
+		}
+	}
+
+	ParseResourceList( hintlist, names );
+
+	return Queue( names, 0 );
+}
+
+int CPrefetcher::Hint( const std::vector<std::string> &names )
+{
+	return Queue( names, 0 );
+}
+
+WaitForResourcesHandle_t CPrefetcher::Wait( const char *resourcelist )
+{
+	std::vector<std::string> names;
+
+	ParseResourceList( resourcelist, names );
+
+	std::unique_lock<std::mutex> lock( m_Mutex );
+	int group = m_iNextGroup++;
+	prefetchGroup_t &g = m_Groups[group];
+
+	g.total = g.done = 0;
+	g.pending = 0;
+	lock.unlock();
+
+	if( !Queue( names, group ))
+	{
+		lock.lock();
+		m_Groups.erase( group );
+		return 0; // nothing to wait on
+	}
+
+	return group;
+}
+
+bool CPrefetcher::Progress( WaitForResourcesHandle_t handle, float *progress, bool *complete )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	std::map<int, prefetchGroup_t>::iterator it = m_Groups.find( handle );
+
+	if( it == m_Groups.end() )
+	{
+		if( progress ) *progress = 0.0f;
+		if( complete ) *complete = true;
+		return false;
+	}
+
+	prefetchGroup_t &g = it->second;
+	bool done = g.pending == 0;
+
+	if( progress ) *progress = done || !g.total ? 1.0f : (float)g.done / g.total;
+	if( complete ) *complete = done;
+
+	// handle is finished with
+	if( done )
+		m_Groups.erase( it );
+
+	return true;
+}
+
+void CPrefetcher::Cancel( WaitForResourcesHandle_t handle )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	std::map<int, prefetchGroup_t>::iterator it = m_Groups.find( handle );
+
+	if( it == m_Groups.end() )
+		return;
+
+	std::deque<prefetchJob_t>::iterator job = m_Queue.begin();
+
+	while( job != m_Queue.end() )
+	{
+		if( job->group == handle )
+			job = m_Queue.erase( job );
+		else ++job;
+	}
+
+	// jobs running right now will see it's gone
+	m_Groups.erase( it );
+}
+
+void CPrefetcher::Shutdown()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	m_bShutdown = true;
+	m_Queue.clear();
+	m_Groups.clear();
+	m_Cond.notify_all();
+	lock.unlock();
+
+	ioScheduler.Wake();
+
+	for( size_t i = 0; i < m_Workers.size(); i++ )
+		m_Workers[i].join();
+
+	lock.lock();
+	m_Workers.clear();
+	m_bShutdown = false;
+}
+
+int CPrefetcher::Queue( const std::vector<std::string> &names, int group )
+{
+	std::vector<prefetchJob_t> jobs;
+	snapshotRef_t index = searchIndex.Pin();
+
+	// resolve here, so workers never touch engine or index
+	for( size_t i = 0; i < names.size(); i++ )
+	{
+		prefetchJob_t job;
+
+		job.group = group;
+
+		if( Resolve( index.get(), names[i], job ))
+			jobs.push_back( job );
+	}
+
+	if( jobs.empty() )
+		return 0;
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	if( group )
+	{
+		prefetchGroup_t &g = m_Groups[group];
+
+		for( size_t i = 0; i < jobs.size(); i++ )
+			g.total += jobs[i].length;
+		g.pending += jobs.size();
+	}
+
+	m_Queue.insert( m_Queue.end(), jobs.begin(), jobs.end() );
+
+	StartWorkers();
+	m_Cond.notify_all();
+
+	return jobs.size();
+}
+
+bool CPrefetcher::Resolve( CSearchSnapshot *index, const std::string &name, prefetchJob_t &job )
+{
+	indexSource_t *source = index->Find( name.c_str(), false );
+
+	if( source && source->origin == FILE_ORIGIN_PAK )
+	{
+		CPackFile *pack = Pack_ForSearchPath( source->search );
+		const packEntry_t *entry = pack ? pack->FindEntry( name.c_str() ) : NULL;
+
+		if( !entry )
+			return false;
+
+		job.path = pack->Filename();
+		job.offset = entry->offset;
+		job.length = entry->size;
+		return true;
+	}
+
+	char path[MAX_SYSPATH];
+
+	if( source && index->DiskPath( source, name.c_str(), path, sizeof( path )))
+	{
+		if( !index->Stat( source, name.c_str() ))
+			return false;
+
+		job.path = path;
+		job.offset = 0;
+		job.length = source->size;
+		return true;
+	}
+
+	// not indexed, but may still be a plain file
+	if( !engine.GetDiskPath( name.c_str(), false, path, sizeof( path )))
+		return false;
+
+	struct stat st;
+
+	if( stat( path, &st ) < 0 )
+		return false;
+
+	job.path = path;
+	job.offset = 0;
+	job.length = st.st_size;
+	return true;
+}
+
+// called with m_Mutex held
+void CPrefetcher::StartWorkers()
+{
+	if( !m_Workers.empty() )
+		return;
+
+	int count = std::thread::hardware_concurrency();
+
+	if( count < 1 )
+		count = 1;
+	else if( count > MAX_PREFETCH_THREADS )
+		count = MAX_PREFETCH_THREADS;
+
+	for( int i = 0; i < count; i++ )
+		m_Workers.push_back( std::thread( &CPrefetcher::WorkerThread, this ));
+}
+
+void CPrefetcher::WorkerThread()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	while( !m_bShutdown )
+	{
+		if( m_Queue.empty() )
+		{
+			m_Cond.wait( lock );
+			continue;
+		}
+
+		prefetchJob_t job = m_Queue.front();
+		m_Queue.pop_front();
+
+		lock.unlock();
+		Warm( job );
+		lock.lock();
+
+		Finished( job );
+	}
+}
+
+// called with m_Mutex held
+void CPrefetcher::Finished( const prefetchJob_t &job )
+{
+	if( !job.group )
+		return;
+
+	std::map<int, prefetchGroup_t>::iterator it = m_Groups.find( job.group );
+
+	if( it == m_Groups.end() )
+		return; // cancelled
+
+	it->second.done += job.length;
+	it->second.pending--;
+}
+
+void CPrefetcher::Warm( const prefetchJob_t &job )
+{
+	// don't even hint while paused
+	if( !ioScheduler.WaitBackground( m_bShutdown ))
+		return;
+
+	int fd = open( job.path.c_str(), O_RDONLY );
+
+	if( fd < 0 )
+		return;
+
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise( fd, job.offset, job.length, POSIX_FADV_WILLNEED );
+#endif
+
+	// hint alone may be ignored, really read it to be sure it's cached
+	char *buf = (char *)malloc( PREFETCH_CHUNK );
+	long pos = job.offset, end = job.offset + job.length;
+
+	while( buf && pos < end && ioScheduler.WaitBackground( m_bShutdown ))
+	{
+		long len = end - pos < PREFETCH_CHUNK ? end - pos : PREFETCH_CHUNK;
+		ssize_t n = pread( fd, buf, len, pos );
+
+		if( n <= 0 )
+			break;
+
+		pos += n;
+	}
+
+	free( buf );
+	close( fd );
+}
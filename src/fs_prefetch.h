@@ -0,0 +1,89 @@
+/*
+fs_prefetch.h - background resource preloading
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_PREFETCH_H
+#define FS_PREFETCH_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "fs_engine.h"
+
+#define MAX_PREFETCH_THREADS 4
+
+class CSearchSnapshot;
+
+// a byte range of file on disk, resolved on the game thread, so
+// workers never have to call the engine
+struct prefetchJob_t
+{
+	std::string path;
+	long offset;
+	long length;
+	int group; // WaitForResources handle, 0 for hints
+};
+
+struct prefetchGroup_t
+{
+	long total;
+	long done;
+	int pending;
+};
+
+// Warms page cache for resources from hint and wait lists with a pool of threads
+class CPrefetcher
+{
+public:
+	CPrefetcher() : m_iNextGroup( 1 ), m_bShutdown( false ) { }
+	~CPrefetcher();
+
+	int Hint( const char *hintlist, bool forgetEverything );
+	int Hint( const std::vector<std::string> &names );
+
+	WaitForResourcesHandle_t Wait( const char *resourcelist );
+	bool Progress( WaitForResourcesHandle_t handle, float *progress, bool *complete );
+	void Cancel( WaitForResourcesHandle_t handle );
+
+	// cancel everything and stop the workers
+	void Shutdown();
+
+private:
+	int Queue( const std::vector<std::string> &names, int group );
+	bool Resolve( CSearchSnapshot *index, const std::string &name, prefetchJob_t &job );
+	void StartWorkers();
+	void WorkerThread();
+	void Warm( const prefetchJob_t &job );
+	void Finished( const prefetchJob_t &job );
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Cond;
+	std::deque<prefetchJob_t> m_Queue;
+	std::vector<std::thread> m_Workers;
+	std::map<int, prefetchGroup_t> m_Groups;
+	int m_iNextGroup;
+	std::atomic<bool> m_bShutdown;
+};
+
+// names from a list file (.res, .lst, .txt) or the list itself,
+// separated by whitespace, commas or semicolons
+void ParseResourceList( const char *list, std::vector<std::string> &names );
+
+extern CPrefetcher prefetcher;
+
+#endif // FS_PREFETCH_H
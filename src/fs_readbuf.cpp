@@ -0,0 +1,302 @@
+/*
+fs_readbuf.cpp - GetReadBuffer/ReleaseReadBuffer backend
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include "fs_readbuf.h"
+#include "fs_pack.h"
+#include "fs_index.h"
+
+CReadBufferCache readBufferCache;
+
+// mapped pages are "in cache" only when the kernel already has all of them
+static bool IsResident( void *base, size_t len )
+{
+	long pageSize = sysconf( _SC_PAGESIZE );
+	std::vector<unsigned char> vec(( len + pageSize - 1 ) / pageSize );
+
+	if( mincore( base, len, vec.data() ) < 0 )
+		return false;
+
+	for( size_t i = 0; i < vec.size(); i++ )
+	{
+		if( !( vec[i] & 1 ))
+			return false;
+	}
+
+	return true;
+}
+
+void *CReadBufferCache::Acquire( CFileHandle *file, int *outBufferSize, bool failIfNotInCache )
+{
+	// writable files can't have a stable view
+	if( file->IsWritable() )
+		return NULL;
+
+	readBuffer_t *buf = NULL;
+
+	switch( file->Origin() )
+	{
+	case FILE_ORIGIN_LOOSE:
+		buf = MapLoose( file, failIfNotInCache );
+		break;
+	case FILE_ORIGIN_PAK:
+		buf = MapPackEntry( file, failIfNotInCache );
+		break;
+	default:
+		break;
+	}
+
+	if( !buf )
+		buf = LoadShared( file, failIfNotInCache );
+
+	if( !buf )
+		return NULL;
+
+	buf->next = file->m_pReadBuffers;
+	file->m_pReadBuffers = buf;
+
+	// whole file is handed out, level log wants to know it was used
+	file->AddBytesRead( buf->size );
+
+	if( outBufferSize )
+		*outBufferSize = buf->size;
+
+	return buf->data;
+}
+
+bool CReadBufferCache::Release( CFileHandle *file, void *readBuffer )
+{
+	readBuffer_t **prev = &file->m_pReadBuffers;
+
+	for( readBuffer_t *buf = *prev; buf; prev = &buf->next, buf = buf->next )
+	{
+		if( buf->data != readBuffer )
+			continue;
+
+		*prev = buf->next;
+		Free( buf );
+		return true;
+	}
+
+	return false;
+}
+
+void CReadBufferCache::ReleaseAll( CFileHandle *file )
+{
+	while( file->m_pReadBuffers )
+	{
+		readBuffer_t *buf = file->m_pReadBuffers;
+
+		file->m_pReadBuffers = buf->next;
+		Free( buf );
+	}
+}
+
+readBuffer_t *CReadBufferCache::MapLoose( CFileHandle *file, bool failIfNotInCache )
+{
+	char diskPath[MAX_SYSPATH];
+	indexSource_t source = { };
+
+	// the file handle was opened from, engine may find another one first
+	source.search = file->SearchPath();
+	source.origin = FILE_ORIGIN_LOOSE;
+
+	if( !source.search || !CSearchSnapshot::DiskPath( &source, file->Name(), diskPath, sizeof( diskPath )))
+		return NULL;
+
+	int fd = open( diskPath, O_RDONLY );
+
+	if( fd < 0 )
+		return NULL;
+
+	struct stat st;
+	void *base = MAP_FAILED;
+
+	// empty files can't be mapped, let shared path handle them
+	if( fstat( fd, &st ) == 0 && st.st_size > 0 && st.st_size <= INT_MAX )
+		base = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+	close( fd );
+
+	if( base == MAP_FAILED )
+		return NULL;
+
+	if( failIfNotInCache && !IsResident( base, st.st_size ))
+	{
+		munmap( base, st.st_size );
+		return NULL;
+	}
+
+	readBuffer_t *buf = new readBuffer_t;
+
+	buf->type = READBUF_MAPPED;
+	buf->data = base;
+	buf->size = st.st_size;
+	buf->mapBase = base;
+	buf->mapLen = st.st_size;
+	buf->shared = NULL;
+
+	return buf;
+}
+
+readBuffer_t *CReadBufferCache::MapPackEntry( CFileHandle *file, bool failIfNotInCache )
+{
+	CPackFile *pack = Pack_ForSearchPath( file->SearchPath() );
+
+	if( !pack )
+		return NULL;
+
+	const packEntry_t *entry = pack->FindEntry( file->Name() );
+
+	if( !entry || entry->size <= 0 )
+		return NULL;
+
+	void *mapBase;
+	size_t mapLen;
+	void *data = pack->MapRange( entry->offset, entry->size, &mapBase, &mapLen );
+
+	if( !data )
+		return NULL;
+
+	if( failIfNotInCache && !IsResident( mapBase, mapLen ))
+	{
+		munmap( mapBase, mapLen );
+		return NULL;
+	}
+
+	readBuffer_t *buf = new readBuffer_t;
+
+	buf->type = READBUF_MAPPED;
+	buf->data = data;
+	buf->size = entry->size;
+	buf->mapBase = mapBase;
+	buf->mapLen = mapLen;
+	buf->shared = NULL;
+
+	return buf;
+}
+
+readBuffer_t *CReadBufferCache::LoadShared( CFileHandle *file, bool failIfNotInCache )
+{
+	char prefix[32];
+	const void *source = file->SearchPath();
+
+	// files of archives mounted by us have no search path, so same name
+	// may come from different archives: these are shared only through
+	// their own backend, it lives longer than buffers of it's handle
+	if( !source )
+		source = file->Backend();
+
+	snprintf( prefix, sizeof( prefix ), "%p:", source );
+
+	std::string key = prefix;
+	key += file->Name();
+
+	sharedBuffer_t *shared;
+	std::unique_lock<std::mutex> lock( m_Mutex );
+	std::unordered_map<std::string, sharedBuffer_t *>::iterator it = m_Shared.find( key );
+
+	if( it != m_Shared.end() )
+	{
+		shared = it->second;
+	}
+	else
+	{
+		if( failIfNotInCache )
+			return NULL;
+
+		lock.unlock();
+
+		// read it whole through the engine, which decompresses it for us once
+		IFileBackend *backend = file->Backend();
+		fs_offset_t size = file->Size();
+
+		if( size < 0 || size > INT_MAX )
+			return NULL;
+
+		fs_offset_t orig = backend->Tell();
+		backend->Seek( 0, SEEK_SET );
+
+		void *data = malloc( size + 1 );
+		fs_offset_t read = data ? backend->Read( data, size ) : -1;
+		backend->Seek( orig, SEEK_SET );
+
+		if( read != size )
+		{
+			free( data );
+			return NULL;
+		}
+
+		lock.lock();
+		it = m_Shared.find( key );
+
+		// loaded by someone else meanwhile
+		if( it != m_Shared.end() )
+		{
+			free( data );
+			shared = it->second;
+		}
+		else
+		{
+			shared = new sharedBuffer_t;
+			shared->key = key;
+			shared->data = data;
+			shared->size = size;
+			shared->refs = 0;
+			m_Shared[key] = shared;
+		}
+	}
+
+	shared->refs++;
+	lock.unlock();
+
+	readBuffer_t *buf = new readBuffer_t;
+
+	buf->type = READBUF_SHARED;
+	buf->data = shared->data;
+	buf->size = shared->size;
+	buf->mapBase = NULL;
+	buf->mapLen = 0;
+	buf->shared = shared;
+
+	return buf;
+}
+
+void CReadBufferCache::Free( readBuffer_t *buf )
+{
+	if( buf->type == READBUF_MAPPED )
+	{
+		munmap( buf->mapBase, buf->mapLen );
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+
+		if( --buf->shared->refs == 0 )
+		{
+			m_Shared.erase( buf->shared->key );
+			free( buf->shared->data );
+			delete buf->shared;
+		}
+	}
+
+	delete buf;
+}
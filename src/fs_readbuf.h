@@ -0,0 +1,69 @@
+/*
+fs_readbuf.h - GetReadBuffer/ReleaseReadBuffer backend
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_READBUF_H
+#define FS_READBUF_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include "fs_handle.h"
+
+enum readBufferType_t
+{
+	READBUF_MAPPED = 0, // read-only mapping of loose file or stored pack entry
+	READBUF_SHARED      // file loaded once through the engine, refcounted
+};
+
+struct sharedBuffer_t
+{
+	std::string key;
+	void *data;
+	int size;
+	int refs;
+};
+
+struct readBuffer_t
+{
+	readBufferType_t type;
+	void *data;
+	int size;
+
+	void *mapBase;
+	size_t mapLen;
+	sharedBuffer_t *shared;
+
+	readBuffer_t *next;
+};
+
+class CReadBufferCache
+{
+public:
+	void *Acquire( CFileHandle *file, int *outBufferSize, bool failIfNotInCache );
+	bool Release( CFileHandle *file, void *readBuffer );
+	void ReleaseAll( CFileHandle *file );
+
+private:
+	readBuffer_t *MapLoose( CFileHandle *file, bool failIfNotInCache );
+	readBuffer_t *MapPackEntry( CFileHandle *file, bool failIfNotInCache );
+	readBuffer_t *LoadShared( CFileHandle *file, bool failIfNotInCache );
+	void Free( readBuffer_t *buf );
+
+	std::mutex m_Mutex; // m_Shared and refs
+	std::unordered_map<std::string, sharedBuffer_t *> m_Shared;
+};
+
+extern CReadBufferCache readBufferCache;
+
+#endif // FS_READBUF_H
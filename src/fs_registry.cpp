@@ -0,0 +1,182 @@
+/*
+fs_registry.cpp - open file handles tracking and usage reports
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdarg.h>
+#include <vector>
+#include <algorithm>
+#include "fs_registry.h"
+
+CHandleRegistry handleRegistry;
+
+static bool OlderHandle( const handleInfo_t &a, const handleInfo_t &b )
+{
+	return a.openTime < b.openTime;
+}
+
+void CHandleRegistry::Warning( const char *fmt, ... )
+{
+	char buf[1024];
+	va_list args;
+
+	va_start( args, fmt );
+	vsnprintf( buf, sizeof( buf ), fmt, args );
+	va_end( args );
+
+	warningFunc_t func = m_pfnWarning;
+
+	if( func )
+		func( "%s", buf );
+	else engine.Msg( "%s", buf );
+}
+
+static handleShard_t &HandleShard( handleShard_t *shards, CFileHandle *handle )
+{
+	return shards[LockShard( (size_t)handle / sizeof( void * ))];
+}
+
+// handles can't be closed while copied, warning function may open and
+// close files itself so it's called only after this
+void CHandleRegistry::Collect( std::vector<handleInfo_t> &out )
+{
+	for( int i = 0; i < LOCK_SHARDS; i++ )
+		m_Shards[i].mutex.lock();
+
+	for( int i = 0; i < LOCK_SHARDS; i++ )
+	{
+		std::unordered_set<CFileHandle *>::const_iterator it;
+
+		for( it = m_Shards[i].handles.begin(); it != m_Shards[i].handles.end(); ++it )
+		{
+			const CFileHandle *h = *it;
+			handleInfo_t info;
+
+			info.name = h->Name();
+			info.pathID = h->PathID() ? h->PathID() : "";
+			info.openTime = h->OpenTime();
+			info.bytesRead = h->BytesRead();
+			info.bytesWritten = h->BytesWritten();
+			info.seeks = h->Seeks();
+			out.push_back( info );
+		}
+	}
+
+	for( int i = 0; i < LOCK_SHARDS; i++ )
+		m_Shards[i].mutex.unlock();
+}
+
+void CHandleRegistry::Opened( CFileHandle *handle )
+{
+	int level = m_iLevel;
+	handleShard_t &shard = HandleShard( m_Shards, handle );
+
+	{
+		std::lock_guard<std::mutex> lock( shard.mutex );
+
+		shard.handles.insert( handle );
+	}
+
+	if( level >= FILESYSTEM_WARNING_REPORTUSAGE )
+	{
+		std::lock_guard<std::mutex> lock( m_UsageMutex );
+
+		m_Usage[handle->Name()].opens++;
+	}
+
+	if( level >= FILESYSTEM_WARNING_REPORTALLACCESSES )
+		Warning( "FS: open \"%s\" (%s)\n", handle->Name(), handle->PathID() ? handle->PathID() : "" );
+}
+
+void CHandleRegistry::Closed( CFileHandle *handle )
+{
+	int level = m_iLevel;
+	handleShard_t &shard = HandleShard( m_Shards, handle );
+
+	{
+		std::lock_guard<std::mutex> lock( shard.mutex );
+
+		shard.handles.erase( handle );
+	}
+
+	if( level >= FILESYSTEM_WARNING_REPORTUSAGE )
+	{
+		std::lock_guard<std::mutex> lock( m_UsageMutex );
+		fileUsage_t &usage = m_Usage[handle->Name()];
+
+		usage.closes++;
+		usage.bytesRead += handle->BytesRead();
+		usage.bytesWritten += handle->BytesWritten();
+		usage.seeks += handle->Seeks();
+	}
+
+	if( level >= FILESYSTEM_WARNING_REPORTALLACCESSES )
+	{
+		Warning( "FS: close \"%s\", %.3f s, %ld read, %ld written, %d seeks\n", handle->Name(),
+			( Sys_MonotonicUsec() - handle->OpenTime() ) / 1000000.0,
+			(long)handle->BytesRead(), (long)handle->BytesWritten(), handle->Seeks() );
+	}
+}
+
+void CHandleRegistry::PrintOpened()
+{
+	std::vector<handleInfo_t> handles;
+	long long now = Sys_MonotonicUsec();
+
+	Collect( handles );
+	std::sort( handles.begin(), handles.end(), OlderHandle );
+
+	Warning( "FS: %d files opened\n", (int)handles.size() );
+
+	for( size_t i = 0; i < handles.size(); i++ )
+	{
+		const handleInfo_t &h = handles[i];
+
+		Warning( "  \"%s\" (%s), %.3f s, %ld read, %ld written, %d seeks\n",
+			h.name.c_str(), h.pathID.c_str(), ( now - h.openTime ) / 1000000.0,
+			(long)h.bytesRead, (long)h.bytesWritten, h.seeks );
+	}
+}
+
+void CHandleRegistry::Report()
+{
+	int level = m_iLevel;
+
+	if( level >= FILESYSTEM_WARNING_REPORTUNCLOSED )
+	{
+		std::vector<handleInfo_t> handles;
+
+		Collect( handles );
+
+		for( size_t i = 0; i < handles.size(); i++ )
+			Warning( "FS: unclosed file \"%s\"\n", handles[i].name.c_str() );
+	}
+
+	std::unordered_map<std::string, fileUsage_t> usage;
+
+	{
+		std::lock_guard<std::mutex> lock( m_UsageMutex );
+
+		usage.swap( m_Usage );
+	}
+
+	if( level >= FILESYSTEM_WARNING_REPORTUSAGE )
+	{
+		for( std::unordered_map<std::string, fileUsage_t>::iterator it = usage.begin(); it != usage.end(); ++it )
+		{
+			const fileUsage_t &u = it->second;
+
+			Warning( "FS: \"%s\" opened %d, closed %d, %ld read, %ld written, %d seeks\n",
+				it->first.c_str(), u.opens, u.closes, (long)u.bytesRead, (long)u.bytesWritten, u.seeks );
+		}
+	}
+}
@@ -0,0 +1,91 @@
+/*
+fs_registry.h - open file handles tracking and usage reports
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_REGISTRY_H
+#define FS_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include "fs_handle.h"
+#include "fs_lock.h"
+
+typedef void (*warningFunc_t)( const char *fmt, ... );
+
+// totals per file name, kept for FILESYSTEM_WARNING_REPORTUSAGE
+struct fileUsage_t
+{
+	int opens;
+	int closes;
+	fs_offset_t bytesRead;
+	fs_offset_t bytesWritten;
+	int seeks;
+};
+
+// copy of a live handle, so warnings are printed with no lock held
+struct handleInfo_t
+{
+	std::string name;
+	std::string pathID;
+	long long openTime;
+	fs_offset_t bytesRead;
+	fs_offset_t bytesWritten;
+	int seeks;
+};
+
+struct handleShard_t
+{
+	std::mutex mutex;
+	std::unordered_set<CFileHandle *> handles;
+};
+
+// Knows every live handle. Only Open and Close take a lock, of one
+// shard picked by handle address, handles count their own I/O
+class CHandleRegistry
+{
+public:
+	CHandleRegistry() : m_pfnWarning( NULL ), m_iLevel( FILESYSTEM_WARNING_QUIET ) { }
+
+	void SetWarningFunc( warningFunc_t func ) { m_pfnWarning = func; }
+	void SetWarningLevel( FileWarningLevel_t level ) { m_iLevel = level; }
+
+	void Opened( CFileHandle *handle );
+	void Closed( CFileHandle *handle );
+
+	// all live handles with their statistics
+	void PrintOpened();
+
+	// on unmount, according to warning level
+	void Report();
+
+private:
+	void Warning( const char *fmt, ... );
+
+	std::atomic<warningFunc_t> m_pfnWarning;
+	std::atomic<int> m_iLevel;
+
+	void Collect( std::vector<handleInfo_t> &out );
+
+	handleShard_t m_Shards[LOCK_SHARDS];
+
+	std::mutex m_UsageMutex;
+	std::unordered_map<std::string, fileUsage_t> m_Usage;
+};
+
+extern CHandleRegistry handleRegistry;
+
+#endif // FS_REGISTRY_H
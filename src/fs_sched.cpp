@@ -0,0 +1,67 @@
+/*
+fs_sched.cpp - foreground/background I/O scheduling
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <unistd.h>
+#include "fs_engine.h"
+#include "fs_sched.h"
+
+CIOScheduler ioScheduler;
+
+void CIOScheduler::ForegroundEnd()
+{
+	m_iLastForeground = Sys_MonotonicUsec();
+	m_iForeground--;
+}
+
+int CIOScheduler::Pause()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	int was = m_bPaused;
+
+	m_bPaused = true;
+	return was;
+}
+
+int CIOScheduler::Resume()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	int was = m_bPaused;
+
+	m_bPaused = false;
+	m_Cond.notify_all();
+	return was;
+}
+
+bool CIOScheduler::WaitBackground( const std::atomic<bool> &abort )
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	while( m_bPaused && !abort )
+		m_Cond.wait( lock );
+
+	lock.unlock();
+
+	// foreground doesn't signal us to stay lock free, so poll
+	while( !abort && ( m_iForeground > 0 || Sys_MonotonicUsec() - m_iLastForeground < FOREGROUND_GRACE_USEC ))
+		usleep( 500 );
+
+	return !abort;
+}
+
+void CIOScheduler::Wake()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	m_Cond.notify_all();
+}
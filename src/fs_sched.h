@@ -0,0 +1,66 @@
+/*
+fs_sched.h - foreground/background I/O scheduling
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_SCHED_H
+#define FS_SCHED_H
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// background work waits this long after last foreground I/O
+#define FOREGROUND_GRACE_USEC	2000
+
+// Game thread I/O always goes first. It is done synchronously through
+// the engine, so background preloading steps aside instead: it waits
+// between chunks while foreground I/O is in flight or was just done,
+// and doesn't run at all while preloading is paused
+class CIOScheduler
+{
+public:
+	CIOScheduler() : m_iForeground( 0 ), m_iLastForeground( 0 ), m_bPaused( false ) { }
+
+	// cheap, no locks, called around every game thread Open and Read
+	void ForegroundBegin() { m_iForeground++; }
+	void ForegroundEnd();
+
+	// return previous state
+	int Pause();
+	int Resume();
+
+	// background workers call this before each piece of work,
+	// returns false when abort was requested
+	bool WaitBackground( const std::atomic<bool> &abort );
+
+	// let waiting workers see abort flag
+	void Wake();
+
+private:
+	std::mutex m_Mutex;
+	std::condition_variable m_Cond;
+	std::atomic<int> m_iForeground;
+	std::atomic<long long> m_iLastForeground;
+	bool m_bPaused;
+};
+
+extern CIOScheduler ioScheduler;
+
+class CForegroundIO
+{
+public:
+	CForegroundIO() { ioScheduler.ForegroundBegin(); }
+	~CForegroundIO() { ioScheduler.ForegroundEnd(); }
+};
+
+#endif // FS_SCHED_H
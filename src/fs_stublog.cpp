@@ -0,0 +1,139 @@
+/*
+fs_stublog.cpp - deduplicated, rate limited reporting of stub calls
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <stdarg.h>
+#include <algorithm>
+#include "fs_stublog.h"
+
+CStubLog stubLog;
+
+CStubSite::CStubSite( const char *func ) : m_pszFunc( func ), m_iState( SITE_IDLE ), m_iHits( 0 ), m_iNextReport( 0 )
+{
+	m_szArgs[0] = 0;
+	stubLog.Register( this );
+}
+
+CStubSite::~CStubSite()
+{
+	stubLog.Unregister( this );
+}
+
+void CStubSite::Hit( const char *format, ... )
+{
+	m_iHits.fetch_add( 1, std::memory_order_relaxed );
+
+	// already waiting to be printed
+	if( m_iState.load( std::memory_order_relaxed ) != SITE_IDLE )
+		return;
+
+	int idle = SITE_IDLE;
+
+	if( !m_iState.compare_exchange_strong( idle, SITE_WRITING, std::memory_order_acquire ))
+		return;
+
+	va_list args;
+
+	va_start( args, format );
+	vsnprintf( m_szArgs, sizeof( m_szArgs ), format, args );
+	va_end( args );
+
+	m_iState.store( SITE_READY, std::memory_order_release );
+}
+
+void CStubLog::Start()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	if( m_bRunning )
+		return;
+
+	m_bShutdown = false;
+	m_bRunning = true;
+	m_Thread = std::thread( &CStubLog::LoggerThread, this );
+}
+
+void CStubLog::Shutdown()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	if( m_bRunning )
+	{
+		m_bShutdown = true;
+		m_Cond.notify_all();
+		lock.unlock();
+
+		m_Thread.join();
+
+		lock.lock();
+		m_bRunning = false;
+	}
+
+	long long now = Sys_MonotonicUsec();
+
+	for( size_t i = 0; i < m_Sites.size(); i++ )
+		Report( m_Sites[i], now, true );
+}
+
+void CStubLog::Register( CStubSite *site )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	m_Sites.push_back( site );
+}
+
+// static sites go away at exit, last of their calls are printed then
+void CStubLog::Unregister( CStubSite *site )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	Report( site, Sys_MonotonicUsec(), true );
+	m_Sites.erase( std::remove( m_Sites.begin(), m_Sites.end(), site ), m_Sites.end() );
+}
+
+void CStubLog::LoggerThread()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	while( !m_bShutdown )
+	{
+		m_Cond.wait_for( lock, std::chrono::milliseconds( STUBLOG_TICK_MSEC ));
+
+		long long now = Sys_MonotonicUsec();
+
+		for( size_t i = 0; i < m_Sites.size(); i++ )
+			Report( m_Sites[i], now, false );
+	}
+}
+
+// called with m_Mutex held
+void CStubLog::Report( CStubSite *site, long long now, bool force )
+{
+	if( site->m_iState.load( std::memory_order_acquire ) != CStubSite::SITE_READY )
+		return;
+
+	if( !force && now < site->m_iNextReport )
+		return;
+
+	unsigned int hits = site->m_iHits.exchange( 0, std::memory_order_relaxed );
+
+	if( hits > 1 )
+		printf( "FS_Stdio_Xash: called a stub: %s  ->(%s), %u times\n", site->m_pszFunc, site->m_szArgs, hits );
+	else printf( "FS_Stdio_Xash: called a stub: %s  ->(%s)\n", site->m_pszFunc, site->m_szArgs );
+
+	fflush( stdout );
+
+	site->m_iNextReport = now + STUBLOG_REPEAT_SEC * 1000000LL;
+	site->m_iState.store( CStubSite::SITE_IDLE, std::memory_order_release );
+}
@@ -0,0 +1,90 @@
+/*
+fs_stublog.h - deduplicated, rate limited reporting of stub calls
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_STUBLOG_H
+#define FS_STUBLOG_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "fs_metrics.h"
+
+#define STUBLOG_TICK_MSEC	250 // first call of a stub is printed this soon
+#define STUBLOG_REPEAT_SEC	60 // same stub is printed again at most this often
+#define STUBLOG_ARGS_LEN	128
+
+// One per STUBCALL. Calls between two reports are only counted,
+// arguments are formatted for the first of them only
+class CStubSite
+{
+public:
+	explicit CStubSite( const char *func );
+	~CStubSite();
+
+	void Hit( const char *format, ... ) __attribute__(( format( printf, 2, 3 )));
+
+private:
+	friend class CStubLog;
+
+	enum
+	{
+		SITE_IDLE = 0,
+		SITE_WRITING, // arguments are being formatted
+		SITE_READY // waits to be printed
+	};
+
+	const char *m_pszFunc;
+	std::atomic<int> m_iState;
+	std::atomic<unsigned int> m_iHits; // since last report
+	long long m_iNextReport; // usec, log thread only
+	char m_szArgs[STUBLOG_ARGS_LEN];
+};
+
+// Prints stub reports from it's own thread, so a stub called every
+// frame never waits for stdout
+class CStubLog
+{
+public:
+	CStubLog() : m_bShutdown( false ), m_bRunning( false ) { }
+	~CStubLog() { Shutdown(); }
+
+	void Start();
+
+	// print everything pending and stop the thread
+	void Shutdown();
+
+	void Register( CStubSite *site );
+	void Unregister( CStubSite *site );
+
+private:
+	void LoggerThread();
+	void Report( CStubSite *site, long long now, bool force );
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Cond;
+	std::vector<CStubSite *> m_Sites;
+	std::thread m_Thread;
+	bool m_bShutdown;
+	bool m_bRunning;
+};
+
+extern CStubLog stubLog;
+
+// stub hits are also counted in metrics, so it's known which of them matter
+#define STUBCALL( format, ... ) { COUNTCALL( "stub" ); static CStubSite stubSite( __PRETTY_FUNCTION__ ); stubSite.Hit( format, __VA_ARGS__ ); }
+#define STUBCALL_VOID			{ COUNTCALL( "stub" ); static CStubSite stubSite( __PRETTY_FUNCTION__ ); stubSite.Hit( "void" ); }
+
+#endif // FS_STUBLOG_H
@@ -0,0 +1,248 @@
+/*
+fs_trace.cpp - Chrome trace event capture of filesystem calls
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "fs_trace.h"
+#include "fs_handle.h"
+
+CTracer tracer;
+
+static long CurrentThreadID()
+{
+#ifdef SYS_gettid
+	return syscall( SYS_gettid );
+#else
+	static std::atomic<long> next( 1 );
+	return next++;
+#endif
+}
+
+static void CopyField( char *out, size_t size, const char *str )
+{
+	if( !str )
+	{
+		out[0] = 0;
+		return;
+	}
+
+	strncpy( out, str, size - 1 );
+	out[size - 1] = 0;
+}
+
+static void WriteString( FILE *f, const char *str )
+{
+	fputc( '"', f );
+
+	for( ; *str; str++ )
+	{
+		unsigned char c = *str;
+
+		if( c == '"' || c == '\\' )
+			fprintf( f, "\\%c", c );
+		else if( c < 0x20 )
+			fprintf( f, "\\u%04x", c );
+		else fputc( c, f );
+	}
+
+	fputc( '"', f );
+}
+
+CTracer::~CTracer()
+{
+	Shutdown();
+
+	for( size_t i = 0; i < m_Rings.size(); i++ )
+		delete m_Rings[i];
+}
+
+void CTracer::Start()
+{
+	const char *env = getenv( TRACE_ENV );
+
+	if( IsActive() || !env || !*env )
+		return;
+
+	m_pFile = fopen( env, "w" );
+
+	if( !m_pFile )
+	{
+		engine.Msg( "FS_Stdio_Xash: can't write trace to %s\n", env );
+		return;
+	}
+
+	fputs( "[", m_pFile );
+	m_iEvents = 0;
+	m_bShutdown = false;
+	m_bActive = true;
+	m_Thread = std::thread( &CTracer::WriterThread, this );
+}
+
+void CTracer::Shutdown()
+{
+	if( !IsActive() )
+		return;
+
+	m_bActive = false;
+
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	m_bShutdown = true;
+	m_Cond.notify_all();
+	lock.unlock();
+
+	m_Thread.join();
+
+	// calls that were in flight may have recorded something meanwhile
+	lock.lock();
+	Drain();
+
+	unsigned int dropped = 0;
+
+	for( size_t i = 0; i < m_Rings.size(); i++ )
+		dropped += m_Rings[i]->dropped.exchange( 0 );
+
+	fputs( "\n]\n", m_pFile );
+	fclose( m_pFile );
+	m_pFile = NULL;
+
+	engine.Msg( "FS_Stdio_Xash: trace: %u events written, %u dropped\n", m_iEvents, dropped );
+}
+
+// ring of calling thread, made on first use
+traceRing_t *CTracer::Ring()
+{
+	static thread_local traceRing_t *ring;
+
+	if( ring )
+		return ring;
+
+	ring = new traceRing_t;
+	ring->head = ring->tail = ring->dropped = 0;
+	ring->tid = CurrentThreadID();
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	m_Rings.push_back( ring );
+
+	return ring;
+}
+
+void CTracer::Record( const traceEvent_t &event )
+{
+	traceRing_t *ring = Ring();
+	unsigned int head = ring->head.load( std::memory_order_relaxed );
+
+	// writer is behind, losing an event is better than waiting for it
+	if( head - ring->tail.load( std::memory_order_acquire ) >= TRACE_RING_SIZE )
+	{
+		ring->dropped.fetch_add( 1, std::memory_order_relaxed );
+		return;
+	}
+
+	ring->events[head & ( TRACE_RING_SIZE - 1 )] = event;
+	ring->head.store( head + 1, std::memory_order_release );
+}
+
+void CTracer::WriterThread()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	while( !m_bShutdown )
+	{
+		m_Cond.wait_for( lock, std::chrono::milliseconds( TRACE_FLUSH_MSEC ));
+		Drain();
+	}
+}
+
+// called with m_Mutex held
+void CTracer::Drain()
+{
+	for( size_t i = 0; i < m_Rings.size(); i++ )
+	{
+		traceRing_t *ring = m_Rings[i];
+		unsigned int tail = ring->tail.load( std::memory_order_relaxed );
+		unsigned int head = ring->head.load( std::memory_order_acquire );
+
+		for( ; tail != head; tail++ )
+			WriteEvent( ring->events[tail & ( TRACE_RING_SIZE - 1 )], ring->tid );
+
+		ring->tail.store( tail, std::memory_order_release );
+	}
+
+	fflush( m_pFile );
+}
+
+void CTracer::WriteEvent( const traceEvent_t &event, long tid )
+{
+	fprintf( m_pFile, "%s\n{\"name\":\"%s\",\"cat\":\"fs\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%ld,\"args\":{",
+		m_iEvents ? "," : "", event.func, event.begin, event.end - event.begin, (int)getpid(), tid );
+
+	const char *sep = "";
+
+	if( event.name[0] )
+	{
+		fputs( "\"name\":", m_pFile );
+		WriteString( m_pFile, event.name );
+		sep = ",";
+	}
+
+	if( event.pathID[0] )
+	{
+		fprintf( m_pFile, "%s\"pathID\":", sep );
+		WriteString( m_pFile, event.pathID );
+		sep = ",";
+	}
+
+	if( event.bytes >= 0 )
+		fprintf( m_pFile, "%s\"bytes\":%lld", sep, event.bytes );
+
+	fputs( "}}", m_pFile );
+	m_iEvents++;
+}
+
+CTraceScope::CTraceScope( const char *func, const char *name, const char *pathID )
+{
+	m_bActive = tracer.IsActive();
+
+	if( m_bActive )
+		Begin( func, name, pathID );
+}
+
+CTraceScope::CTraceScope( const char *func, const CFileHandle *handle )
+{
+	m_bActive = tracer.IsActive();
+
+	if( m_bActive )
+		Begin( func, handle ? handle->Name() : NULL, handle ? handle->PathID() : NULL );
+}
+
+CTraceScope::~CTraceScope()
+{
+	if( !m_bActive )
+		return;
+
+	m_Event.end = Sys_MonotonicUsec();
+	tracer.Record( m_Event );
+}
+
+void CTraceScope::Begin( const char *func, const char *name, const char *pathID )
+{
+	m_Event.func = func;
+	m_Event.bytes = -1;
+	CopyField( m_Event.name, sizeof( m_Event.name ), name );
+	CopyField( m_Event.pathID, sizeof( m_Event.pathID ), pathID );
+	m_Event.begin = Sys_MonotonicUsec();
+}
@@ -0,0 +1,117 @@
+/*
+fs_trace.h - Chrome trace event capture of filesystem calls
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_TRACE_H
+#define FS_TRACE_H
+
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "fs_metrics.h"
+
+#define TRACE_ENV "FS_STDIO_TRACE" // file to write trace to, unset to disable
+
+#define TRACE_RING_SIZE		4096 // events per thread not written out yet, must be power of two
+#define TRACE_FLUSH_MSEC	100
+#define TRACE_NAME_LEN		96
+#define TRACE_PATHID_LEN	16
+
+class CFileHandle;
+
+struct traceEvent_t
+{
+	const char *func; // static string
+	long long begin; // usec
+	long long end;
+	long long bytes; // -1 if call doesn't move data
+	char name[TRACE_NAME_LEN]; // file, path or wildcard
+	char pathID[TRACE_PATHID_LEN];
+};
+
+// Written by it's thread only, read by writer thread only,
+// so neither of them ever waits for the other
+struct traceRing_t
+{
+	traceEvent_t events[TRACE_RING_SIZE];
+	std::atomic<unsigned int> head; // next to be filled
+	std::atomic<unsigned int> tail; // next to be written out
+	std::atomic<unsigned int> dropped; // ring was full
+	long tid;
+};
+
+// Every call through IFileSystem is recorded with it's begin and end
+// time, thread and what it was called for, then written out from own
+// thread as JSON that chrome://tracing and Perfetto can open
+class CTracer
+{
+public:
+	CTracer() : m_bActive( false ), m_bShutdown( false ), m_pFile( NULL ), m_iEvents( 0 ) { }
+	~CTracer();
+
+	// starts thread if enabled by TRACE_ENV
+	void Start();
+
+	// write out everything and close the trace
+	void Shutdown();
+
+	bool IsActive() const { return m_bActive.load( std::memory_order_relaxed ); }
+
+	void Record( const traceEvent_t &event );
+
+private:
+	traceRing_t *Ring();
+	void WriterThread();
+	void Drain();
+	void WriteEvent( const traceEvent_t &event, long tid );
+
+	std::atomic<bool> m_bActive;
+	std::atomic<bool> m_bShutdown;
+
+	std::mutex m_Mutex; // rings list and the file
+	std::condition_variable m_Cond;
+	std::vector<traceRing_t *> m_Rings; // never freed, threads keep pointers to them
+	std::thread m_Thread;
+	FILE *m_pFile;
+	unsigned int m_iEvents;
+};
+
+extern CTracer tracer;
+
+// Records the call it's declared in when it goes out of scope
+class CTraceScope
+{
+public:
+	CTraceScope( const char *func, const char *name, const char *pathID = NULL );
+	CTraceScope( const char *func, const CFileHandle *handle );
+	~CTraceScope();
+
+	// bytes moved by the call, returns it back for convenience
+	template<typename T> T Bytes( T bytes ) { m_Event.bytes = (long long)bytes; return bytes; }
+
+private:
+	void Begin( const char *func, const char *name, const char *pathID );
+
+	bool m_bActive;
+	traceEvent_t m_Event;
+};
+
+// calls are counted even when not traced
+#define TRACECALL_NAMED( func, ... )	COUNTCALL_NAMED( "calls", func ); CTraceScope trace( func, __VA_ARGS__ )
+#define TRACECALL( ... )	TRACECALL_NAMED( __FUNCTION__, __VA_ARGS__ )
+#define TRACECALL_VOID		COUNTCALL( "calls" ); CTraceScope trace( __FUNCTION__, (const char *)NULL )
+
+#endif // FS_TRACE_H
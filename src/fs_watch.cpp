@@ -0,0 +1,387 @@
+/*
+fs_watch.cpp - loose file change notifications
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "fs_watch.h"
+#include "fs_index.h"
+#include "fs_lookup.h"
+#include "fs_content.h"
+
+CFileWatcher fileWatcher;
+
+#ifdef __linux__
+
+#define WATCH_MASK ( IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR )
+
+// search path and directory in it joined, without trailing slash
+static std::string WatchPath( const searchpath_t *search, const std::string &dir )
+{
+	std::string path = search->filename;
+
+	while( !path.empty() && path[path.size() - 1] == '/' )
+		path.erase( path.size() - 1 );
+
+	if( !dir.empty() )
+		path += '/' + dir;
+
+	return path;
+}
+
+void CFileWatcher::Start()
+{
+	const char *env = getenv( WATCH_ENV );
+
+	if( IsActive() || ( env && !strcmp( env, "0" )))
+		return;
+
+	m_iFd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+
+	if( m_iFd < 0 )
+		return;
+
+	if( pipe( m_iWake ) < 0 )
+	{
+		close( m_iFd );
+		m_iFd = -1;
+		return;
+	}
+
+	Rewatch();
+
+	m_Thread = std::thread( &CFileWatcher::ReaderThread, this );
+}
+
+void CFileWatcher::Stop()
+{
+	if( !IsActive() )
+		return;
+
+	// reader sees the hangup
+	close( m_iWake[1] );
+	m_Thread.join();
+
+	close( m_iWake[0] );
+	close( m_iFd );
+	m_iFd = m_iWake[0] = m_iWake[1] = -1;
+
+	m_Dirs.clear();
+	PublishWatched();
+	m_Events.clear();
+	m_bPending = false;
+}
+
+void CFileWatcher::Rewatch()
+{
+	if( !IsActive() )
+		return;
+
+	Unwatch();
+
+	snapshotRef_t index = searchIndex.Pin();
+	const std::vector<searchpath_t *> &paths = index->Paths();
+
+	for( size_t i = 0; i < paths.size(); i++ )
+	{
+		searchpath_t *search = paths[i];
+
+		if( search->pack || search->wad )
+			continue;
+
+		Watch( search, "", 0 );
+	}
+
+	PublishWatched();
+}
+
+void CFileWatcher::Unwatch()
+{
+	std::unordered_map<int, watchDir_t>::iterator it;
+
+	// events already queued for these are ignored by Apply
+	for( it = m_Dirs.begin(); it != m_Dirs.end(); ++it )
+		inotify_rm_watch( m_iFd, it->first );
+
+	m_Dirs.clear();
+	PublishWatched();
+}
+
+void CFileWatcher::Unwatch( const searchpath_t *search )
+{
+	std::unordered_map<int, watchDir_t>::iterator it = m_Dirs.begin();
+
+	if( !IsActive() )
+		return;
+
+	while( it != m_Dirs.end() )
+	{
+		if( it->second.search != search )
+		{
+			++it;
+			continue;
+		}
+
+		inotify_rm_watch( m_iFd, it->first );
+		it = m_Dirs.erase( it );
+	}
+
+	PublishWatched();
+}
+
+// readers don't take searchPathLock, so they get a copy of what's watched
+void CFileWatcher::PublishWatched()
+{
+	std::shared_ptr<dirSet_t> watched = std::make_shared<dirSet_t>();
+	std::unordered_map<int, watchDir_t>::const_iterator it;
+
+	for( it = m_Dirs.begin(); it != m_Dirs.end(); ++it )
+		watched->insert( WatchPath( it->second.search, it->second.dir ));
+
+	std::atomic_store( &m_pWatched, std::shared_ptr<const dirSet_t>( watched ));
+}
+
+void CFileWatcher::Watch( searchpath_t *search, const std::string &dir, int depth )
+{
+	std::string path = WatchPath( search, dir );
+
+	int wd = inotify_add_watch( m_iFd, path.c_str(), WATCH_MASK );
+
+	if( wd < 0 )
+	{
+		engine.Msg( "FS_Stdio_Xash: can't watch %s, changes there won't be noticed\n", path.c_str() );
+		return;
+	}
+
+	watchDir_t &watch = m_Dirs[wd];
+
+	watch.search = search;
+	watch.dir = dir;
+	watch.depth = depth;
+
+	if( depth >= MAX_WATCH_DEPTH )
+		return;
+
+	DIR *d = opendir( path.c_str() );
+
+	if( !d )
+		return;
+
+	while( struct dirent *ent = readdir( d ))
+	{
+		if( ent->d_name[0] == '.' && ( !ent->d_name[1] || ( ent->d_name[1] == '.' && !ent->d_name[2] )))
+			continue;
+
+		std::string child = dir.empty() ? ent->d_name : dir + '/' + ent->d_name;
+		struct stat st;
+
+		if( stat(( path + '/' + ent->d_name ).c_str(), &st ) == 0 && S_ISDIR( st.st_mode ))
+			Watch( search, child, depth + 1 );
+	}
+
+	closedir( d );
+}
+
+bool CFileWatcher::Covers( const char *path ) const
+{
+	if( !IsActive() || path[0] == '/' || strstr( path, ".." ))
+		return false;
+
+	const char *slash = strrchr( path, '/' );
+
+	if( !slash )
+		return false;
+
+	std::shared_ptr<const dirSet_t> watched = std::atomic_load( &m_pWatched );
+
+	return watched->count( std::string( path, slash - path )) != 0;
+}
+
+bool CFileWatcher::CoversDir( const searchpath_t *search, const std::string &dir ) const
+{
+	if( !IsActive() )
+		return false;
+
+	std::shared_ptr<const dirSet_t> watched = std::atomic_load( &m_pWatched );
+	std::string path = WatchPath( search, dir );
+	std::string root = WatchPath( search, "" );
+
+	// creating a missing directory is seen by it's parent
+	while( !watched->count( path ))
+	{
+		struct stat st;
+		size_t slash = path.rfind( '/' );
+
+		if( path.size() <= root.size() || slash == std::string::npos || stat( path.c_str(), &st ) == 0 )
+			return false;
+
+		path.erase( slash );
+	}
+
+	return true;
+}
+
+void CFileWatcher::ReaderThread()
+{
+	char buf[4096] __attribute__(( aligned( __alignof__( struct inotify_event ))));
+	struct pollfd fds[2];
+
+	fds[0].fd = m_iFd;
+	fds[0].events = POLLIN;
+	fds[1].fd = m_iWake[0];
+	fds[1].events = POLLIN;
+
+	while( poll( fds, 2, -1 ) >= 0 || errno == EINTR )
+	{
+		if( fds[1].revents )
+			break;
+
+		if( !( fds[0].revents & POLLIN ))
+			continue;
+
+		ssize_t len = read( m_iFd, buf, sizeof( buf ));
+
+		if( len <= 0 )
+			continue;
+
+		std::lock_guard<std::mutex> lock( m_Mutex );
+
+		for( char *p = buf; p < buf + len; )
+		{
+			struct inotify_event *ev = (struct inotify_event *)p;
+			watchEvent_t event;
+
+			event.wd = ev->wd;
+			event.mask = ev->mask;
+			if( ev->len )
+				event.name = ev->name;
+
+			m_Events.push_back( event );
+			p += sizeof( struct inotify_event ) + ev->len;
+		}
+
+		m_bPending.store( true, std::memory_order_release );
+	}
+}
+
+void CFileWatcher::Apply()
+{
+	std::unique_lock<std::mutex> pathLock( searchPathLock, std::try_to_lock );
+	std::vector<watchEvent_t> events;
+
+	// search paths are being changed, lookups go on with what they have
+	if( !pathLock.owns_lock() )
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+
+		events.swap( m_Events );
+		m_bPending.store( false, std::memory_order_relaxed );
+	}
+
+	bool rebuild = false, changed = false;
+	std::unordered_set<std::string> seen;
+
+	for( size_t i = 0; i < events.size(); i++ )
+	{
+		const watchEvent_t &event = events[i];
+
+		// lost some, can't tell what has changed
+		if( event.mask & IN_Q_OVERFLOW )
+		{
+			rebuild = true;
+			continue;
+		}
+
+		std::unordered_map<int, watchDir_t>::iterator it = m_Dirs.find( event.wd );
+
+		if( it == m_Dirs.end() )
+			continue;
+
+		if( event.mask & IN_IGNORED )
+		{
+			m_Dirs.erase( it );
+			changed = true;
+			continue;
+		}
+
+		if( event.name.empty() )
+			continue;
+
+		watchDir_t watch = it->second;
+		std::string name = watch.dir.empty() ? event.name : watch.dir + '/' + event.name;
+		std::string path = WatchPath( watch.search, name );
+		bool isDir = ( event.mask & IN_ISDIR ) != 0;
+
+		// new directory is watched before it's read, so nothing in it is missed
+		if( isDir && ( event.mask & ( IN_CREATE | IN_MOVED_TO )) && watch.depth < MAX_WATCH_DEPTH )
+		{
+			Watch( watch.search, name, watch.depth + 1 );
+			changed = true;
+		}
+
+		// what's on disk is read when it's applied, so one is enough for many events
+		if( rebuild || !seen.insert(( isDir ? "d" : "f" ) + path ).second )
+			continue;
+
+		lookupCache.Invalidate( name.c_str() );
+		lookupCache.Invalidate( path.c_str() );
+
+		// directories bring or take away whole trees, only these are looked up again
+		if( isDir )
+		{
+			searchIndex.UpdateTree( watch.search, name.c_str() );
+			lookupCache.InvalidateTree( name.c_str() );
+			lookupCache.InvalidateTree( path.c_str() );
+			contentCache.InvalidateTree( name.c_str() );
+			continue;
+		}
+
+		searchIndex.Update( name.c_str() );
+		contentCache.Invalidate( name.c_str() );
+	}
+
+	if( changed )
+		PublishWatched();
+
+	if( rebuild )
+	{
+		if( searchIndex.IsActive() )
+			searchIndex.Build();
+
+		lookupCache.Flush();
+		contentCache.Flush();
+	}
+}
+
+#else // __linux__
+
+void CFileWatcher::Start() { }
+void CFileWatcher::Stop() { }
+void CFileWatcher::Rewatch() { }
+void CFileWatcher::Unwatch( const searchpath_t *search ) { }
+bool CFileWatcher::Covers( const char *path ) const { return false; }
+bool CFileWatcher::CoversDir( const searchpath_t *search, const std::string &dir ) const { return false; }
+void CFileWatcher::Apply() { }
+
+#endif // __linux__
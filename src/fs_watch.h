@@ -0,0 +1,104 @@
+/*
+fs_watch.h - loose file change notifications
+Copyright (C) 2016-2017 a1batross
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+*/
+#ifndef FS_WATCH_H
+#define FS_WATCH_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include "fs_engine.h"
+
+#define MAX_WATCH_DEPTH	16 // same as index
+#define WATCH_ENV		"FS_STDIO_WATCH" // set to 0 to disable
+
+struct watchDir_t
+{
+	searchpath_t *search;
+	std::string dir; // relative to search path, empty for it's root
+	int depth;
+};
+
+struct watchEvent_t
+{
+	int wd;
+	unsigned int mask;
+	std::string name;
+};
+
+// Keeps index and caches coherent with changes made to loose search
+// directories behind our back. Events are read by a thread and applied
+// by Poll with searchPathLock held, so it mustn't be called with the
+// lock held. If search paths are being changed right now, events wait
+// for the next Poll. Poll is a single atomic load when nothing has
+// changed. Does nothing where inotify isn't available
+class CFileWatcher
+{
+public:
+	CFileWatcher() : m_iFd( -1 ), m_pWatched( std::make_shared<dirSet_t>() ), m_bPending( false ) { m_iWake[0] = m_iWake[1] = -1; }
+	~CFileWatcher() { Stop(); }
+
+	void Start();
+	void Stop();
+	bool IsActive() const { return m_iFd >= 0; }
+
+	// search paths changed
+	void Rewatch();
+
+	// search path was removed, the rest are watched as they were
+	void Unwatch( const searchpath_t *search );
+
+	void Poll()
+	{
+		if( m_bPending.load( std::memory_order_acquire ))
+			Apply();
+	}
+
+	// path relative to working directory is in a directory that is
+	// actually watched, so it's answer can be cached
+	bool Covers( const char *path ) const;
+
+	// contents of dir in this loose search path can't change unnoticed:
+	// it's watched, or it doesn't exist and it's nearest parent is
+	bool CoversDir( const searchpath_t *search, const std::string &dir ) const;
+
+private:
+	void Watch( searchpath_t *search, const std::string &dir, int depth );
+	void Unwatch();
+	void PublishWatched();
+	void Apply();
+	void ReaderThread();
+
+	int m_iFd;
+	int m_iWake[2]; // pipe to stop reader
+	std::thread m_Thread;
+
+	typedef std::unordered_set<std::string> dirSet_t;
+
+	std::unordered_map<int, watchDir_t> m_Dirs; // by watch descriptor, under searchPathLock
+	std::shared_ptr<const dirSet_t> m_pWatched; // paths of m_Dirs, without trailing slash, replaced as a whole
+
+	std::mutex m_Mutex;
+	std::vector<watchEvent_t> m_Events; // guarded by m_Mutex
+	std::atomic<bool> m_bPending;
+};
+
+extern CFileWatcher fileWatcher;
+
+#endif // FS_WATCH_H